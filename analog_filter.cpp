@@ -0,0 +1,80 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 15:10:58
+ */
+
+#include "analog_filter.h"
+#include <algorithm>
+#include <stdlib.h>
+
+namespace
+{
+    // 静止時のカットオフ (mHz)
+    constexpr int32_t minCutoffTable_[AnalogFilter::LEVEL_MAX + 1] = {
+        0, 10000, 6000, 4000, 3000, 2000, 1500, 1000, 700, 500};
+
+    // 速度に対するカットオフの上昇 (mHz / (単位/秒))
+    // フルスケールを 0.1 秒で動かすと 80Hz くらい
+    constexpr int32_t BETA = 8;
+
+    // 速度のカットオフ (mHz). 低いと動き始めの遅延が増える
+    constexpr int32_t D_CUTOFF = 8000;
+
+    // 2π * 65536 / 1e9
+    constexpr uint64_t W_SCALE_NUM = 411775;
+    constexpr uint64_t W_SCALE_DEN = 1000000000;
+
+    // カットオフ fc (mHz), dt (us) の 1 次 IIR の係数 (1/65536)
+    int32_t getAlpha(int32_t fc, uint32_t dt)
+    {
+        uint64_t w = uint64_t(fc) * dt * W_SCALE_NUM / W_SCALE_DEN;
+        return static_cast<int32_t>((w << 16) / (w + 65536));
+    }
+
+    int32_t lerp(int32_t a, int32_t b, int32_t alpha)
+    {
+        return a + static_cast<int32_t>((int64_t(b - a) * alpha) >> 16);
+    }
+}
+
+void AnalogFilter::setLevel(int level)
+{
+    level = std::clamp(level, 0, LEVEL_MAX);
+    if (level != level_)
+    {
+        level_ = level;
+        valid_ = false;
+    }
+}
+
+int AnalogFilter::update(int v, uint32_t dt)
+{
+    int32_t x = v << 16;
+
+    // 間が空きすぎたら追従しなおす
+    if (!level_ || !valid_ || dt == 0 || dt > 100000)
+    {
+        valid_ = level_ && dt;
+        x_ = x;
+        prev_ = x;
+        dx_ = 0;
+        return v;
+    }
+
+    int32_t dx = static_cast<int32_t>(int64_t(x - prev_) * 1000000 / dt >> 16);
+    prev_ = x;
+    dx_ = lerp(dx_, dx, getAlpha(D_CUTOFF, dt));
+
+    int32_t fc = minCutoffTable_[level_] + BETA * abs(dx_);
+    x_ = lerp(x_, x, getAlpha(fc, dt));
+
+    return (x_ + 32768) >> 16;
+}
+
+int AnalogFilter::getRestLatency(int level)
+{
+    level = std::clamp(level, 0, LEVEL_MAX);
+    int32_t fc = minCutoffTable_[level];
+    // 1 / (2π fc)
+    return fc ? static_cast<int>(159154943 / fc) : 0;
+}
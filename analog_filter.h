@@ -0,0 +1,35 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 15:03:36
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// アナログ出力の平滑化 (One Euro Filter の固定小数点版)
+// 静止時はカットオフを下げてジッタを消し, 速く動かしたときは上げて遅延を減らす
+class AnalogFilter
+{
+public:
+    static constexpr int LEVEL_MAX = 9;
+
+    // level: 0 で無効. 大きいほど強く平滑化する
+    void setLevel(int level);
+    void reset() { valid_ = false; }
+
+    // v: 0..1024, dt: 前回からの時間 (us)
+    int update(int v, uint32_t dt);
+
+    // 静止時の遅延 (時定数, us)
+    static int getRestLatency(int level);
+
+private:
+    int level_ = 0;
+    bool valid_ = false;
+
+    // 係数が小さいと丸めで偏るので 1/65536 単位で持つ
+    int32_t x_ = 0;
+    int32_t prev_ = 0;
+    int32_t dx_ = 0; // 速度 (単位/秒)
+};
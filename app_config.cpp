@@ -39,11 +39,21 @@ void AppConfig::serialize(Serializer &s)
         s.append8i(v.offset);
         s.append8u(v.scale);
     }
+    for (auto &v : analogSettings)
+    {
+        s.append8u(v.smoothing);
+    }
+    for (auto &re : rotEnc)
+    {
+        s.append8u(re.mode);
+    }
 }
 
 bool AppConfig::deserialize(Deserializer &s)
 {
-    if (s.peek8u() != VERSION)
+    // 4 からは後ろに追加しているだけなので読める
+    int version = s.peek8u();
+    if (version < 4 || version > VERSION)
     {
         return false;
     }
@@ -78,6 +88,20 @@ bool AppConfig::deserialize(Deserializer &s)
         v.offset = s.peek8i();
         v.scale = s.peek8u();
     }
+    if (version >= 5)
+    {
+        for (auto &v : analogSettings)
+        {
+            v.smoothing = s.peek8u();
+        }
+    }
+    if (version >= 6)
+    {
+        for (auto &re : rotEnc)
+        {
+            re.mode = s.peek8u();
+        }
+    }
 
-    return true;
+    return !s.hasError();
 }
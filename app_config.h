@@ -11,7 +11,7 @@ class Deserializer;
 
 struct AppConfig
 {
-    static inline constexpr int VERSION = 4;
+    static inline constexpr int VERSION = 6;
 
     struct RapidSetting
     {
@@ -52,6 +52,7 @@ struct AppConfig
         int reverse = true;
         int scale = 50;
         int axis = 0;
+        int mode = 0; // RotEncoder::Mode
     };
 
     struct AnalogSetting
@@ -59,6 +60,7 @@ struct AppConfig
         int sensitivity = 0;
         int offset = 0;
         int scale = 10;
+        int smoothing = 0; // AnalogFilter のレベル. 0 で無効
     };
     static inline constexpr int ANALOG_MAX = 4;
 
@@ -0,0 +1,745 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 10:31:05
+ */
+
+#include "config_journal.h"
+#include <algorithm>
+#include <cstddef>
+#include <cstring>
+#include "debug.h"
+#include "util.h"
+
+namespace
+{
+    // DELTA の payload
+    //   u16 新しいサイズ
+    //   { u16 ofs, u16 len, u8 data[len] } の繰り返し
+    constexpr size_t RUN_HEADER_SIZE = 4;
+    // これ以下の隙間は1つの run にまとめる
+    constexpr size_t RUN_MERGE_GAP = RUN_HEADER_SIZE;
+
+    void put16(std::vector<uint8_t> &v, uint32_t x)
+    {
+        v.push_back(x & 0xff);
+        v.push_back((x >> 8) & 0xff);
+    }
+
+    void set16(uint8_t *p, uint32_t x)
+    {
+        p[0] = x & 0xff;
+        p[1] = (x >> 8) & 0xff;
+    }
+
+    uint32_t get16(const uint8_t *p)
+    {
+        return p[0] | (p[1] << 8);
+    }
+
+    // DELTA の run を順に f(ofs, data, len) に渡す
+    // 新しいサイズを返す. 壊れていたら -1
+    template <class F>
+    int forEachRun(const uint8_t *p, size_t size, F &&f)
+    {
+        if (size < 2)
+        {
+            return -1;
+        }
+        auto tail = p + size;
+        size_t newSize = get16(p);
+        p += 2;
+
+        while (p < tail)
+        {
+            if (p + RUN_HEADER_SIZE > tail)
+            {
+                return -1;
+            }
+            size_t ofs = get16(p);
+            size_t len = get16(p + 2);
+            p += RUN_HEADER_SIZE;
+            if (ofs + len > newSize || p + len > tail)
+            {
+                return -1;
+            }
+            f(ofs, p, len);
+            p += len;
+        }
+        return newSize;
+    }
+
+    // [ofs, ofs + len) の内容のうち [pos, pos + size) に入る分を buf に写す
+    void copyOverlap(uint8_t *buf, uint32_t pos, size_t size,
+                     const uint8_t *p, uint32_t ofs, size_t len)
+    {
+        uint32_t b = std::max(pos, ofs);
+        uint32_t e = std::min<uint32_t>(pos + size, ofs + len);
+        if (b < e)
+        {
+            memcpy(buf + (b - pos), p + (b - ofs), e - b);
+        }
+    }
+
+    // 流れてくる内容と前回の内容を比べて DELTA を作る
+    // 前回の内容は buf に PAGE_SIZE ずつ読みながら比べる
+    // limit を超えたら作るのをやめて, サイズと CRC だけを数える
+    class DeltaSink : public ConfigJournal::Sink
+    {
+    public:
+        // prev が nullptr なら DELTA は作らない
+        DeltaSink(ConfigJournal *prev, uint8_t *buf, std::vector<uint8_t> &delta, size_t limit)
+            : prev_(prev), prevSize_(prev ? prev->getImageSize() : 0), buf_(buf),
+              delta_(delta), limit_(limit), overflow_(!prev)
+        {
+            delta_.clear();
+            if (!overflow_)
+            {
+                // 途中で確保しなおさないように上限まで取っておく
+                delta_.reserve(limit_ + RUN_HEADER_SIZE + 1);
+                put16(delta_, 0); // 新しいサイズは finish() で入れる
+            }
+        }
+
+        void write(const uint8_t *p, size_t size) override
+        {
+            crc_ = util::crc32(crc_, p, size);
+            for (; size; --size, ++p, ++size_)
+            {
+                if (overflow_)
+                {
+                    continue;
+                }
+
+                bool differs = size_ >= prevSize_ || getPrev(size_) != *p;
+                if (inRun_)
+                {
+                    same_ = differs ? 0 : same_ + 1;
+                }
+                else if (differs)
+                {
+                    openRun();
+                }
+                else
+                {
+                    continue;
+                }
+
+                delta_.push_back(*p);
+                if (delta_.size() > limit_)
+                {
+                    overflow_ = true;
+                    delta_.clear();
+                }
+                else if (same_ > RUN_MERGE_GAP)
+                {
+                    closeRun();
+                }
+            }
+        }
+
+        void finish()
+        {
+            if (!overflow_)
+            {
+                if (inRun_)
+                {
+                    closeRun();
+                }
+                set16(delta_.data(), size_);
+            }
+        }
+
+        size_t getSize() const { return size_; }
+        uint32_t getCRC() const { return crc_; }
+        bool isOverflow() const { return overflow_; }
+        bool isSame() const { return !overflow_ && !runs_ && size_ == prevSize_; }
+
+    private:
+        uint8_t getPrev(size_t pos)
+        {
+            constexpr size_t SIZE = ConfigJournal::PAGE_SIZE;
+            if (pos - bufPos_ >= SIZE)
+            {
+                bufPos_ = pos & ~(SIZE - 1);
+                prev_->readImage(bufPos_, buf_, SIZE);
+            }
+            return buf_[pos - bufPos_];
+        }
+
+        // run の長さは閉じるときに入れる
+        void openRun()
+        {
+            inRun_ = true;
+            same_ = 0;
+            runHead_ = delta_.size();
+            put16(delta_, size_);
+            put16(delta_, 0);
+            ++runs_;
+        }
+
+        // 末尾の一致した分は含めない
+        void closeRun()
+        {
+            delta_.resize(delta_.size() - same_);
+            set16(delta_.data() + runHead_ + 2, delta_.size() - runHead_ - RUN_HEADER_SIZE);
+            inRun_ = false;
+        }
+
+    private:
+        ConfigJournal *prev_;
+        size_t prevSize_;
+        uint8_t *buf_;
+        size_t bufPos_ = ~size_t(0) >> 1; // buf_ の内容の位置. 最初は範囲外
+        std::vector<uint8_t> &delta_;
+        size_t limit_;
+        bool overflow_;
+
+        size_t size_ = 0;
+        uint32_t crc_ = 0;
+        int runs_ = 0;
+        bool inRun_ = false;
+        size_t runHead_ = 0;
+        size_t same_ = 0;
+    };
+
+    // 流れてくる内容のうちレコードの [ofs, ofs + size) の範囲を buf に取り出す
+    class WindowSink : public ConfigJournal::Sink
+    {
+    public:
+        WindowSink(uint8_t *buf, uint32_t ofs, size_t size, uint32_t headerSize)
+            : buf_(buf), ofs_(ofs), end_(ofs + size), pos_(headerSize), headerSize_(headerSize)
+        {
+        }
+
+        void write(const uint8_t *p, size_t size) override
+        {
+            crc_ = util::crc32(crc_, p, size);
+            uint32_t b = std::max(pos_, ofs_);
+            uint32_t e = std::min<uint32_t>(pos_ + size, end_);
+            if (b < e)
+            {
+                memcpy(buf_ + (b - ofs_), p + (b - pos_), e - b);
+            }
+            pos_ += size;
+        }
+
+        size_t getSize() const { return pos_ - headerSize_; }
+        uint32_t getCRC() const { return crc_; }
+
+    private:
+        uint8_t *buf_;
+        uint32_t ofs_;
+        uint32_t end_;
+        uint32_t pos_; // レコード先頭から
+        uint32_t headerSize_;
+        uint32_t crc_ = 0;
+    };
+
+    // FULL と DELTA を重ねた最新の内容を流す. 起動時に FULL を書きなおすとき用
+    class ImageSource : public ConfigJournal::Source
+    {
+    public:
+        ImageSource(ConfigJournal &journal) : journal_(journal) {}
+
+        void generate(ConfigJournal::Sink &sink) override
+        {
+            uint8_t buf[64];
+            size_t size = journal_.getImageSize();
+            for (size_t pos = 0; pos < size; pos += sizeof(buf))
+            {
+                auto n = std::min(size - pos, sizeof(buf));
+                journal_.readImage(pos, buf, n);
+                sink.write(buf, n);
+            }
+        }
+
+    private:
+        ConfigJournal &journal_;
+    };
+}
+
+ConfigJournal::ConfigJournal(Flash &flash, size_t regionSize)
+    : flash_(flash), bankSize_(regionSize / 2)
+{
+}
+
+size_t
+ConfigJournal::getMaxImageSize() const
+{
+    return std::min<size_t>(bankSize_ - sizeof(RecordHeader), 0xffff);
+}
+
+const uint8_t *
+ConfigJournal::getImage(size_t &size)
+{
+    if (!scanned_)
+    {
+        scan();
+    }
+    if (!valid_ || (!resident_ && hasDelta()))
+    {
+        return nullptr;
+    }
+    size = imageSize_;
+    return resident_ ? image_.data() : reinterpret_cast<const uint8_t *>(getHeader(bank_ * bankSize_) + 1);
+}
+
+size_t
+ConfigJournal::getImageSize()
+{
+    if (!scanned_)
+    {
+        scan();
+    }
+    return valid_ ? imageSize_ : 0;
+}
+
+// FULL の上に DELTA を古い順に重ねる
+// サイズが縮んでから伸びた部分は, 伸ばした DELTA に必ず入っている
+void ConfigJournal::readImage(uint32_t pos, uint8_t *buf, size_t size)
+{
+    if (!scanned_)
+    {
+        scan();
+    }
+    std::fill(buf, buf + size, 0xff);
+    if (!valid_)
+    {
+        return;
+    }
+    if (resident_)
+    {
+        copyOverlap(buf, pos, size, image_.data(), 0, image_.size());
+        return;
+    }
+
+    uint32_t ofs = bank_ * bankSize_;
+    auto *h = getHeader(ofs);
+    copyOverlap(buf, pos, size, reinterpret_cast<const uint8_t *>(h + 1), 0, h->size);
+    for (ofs += getRecordSize(h->size); ofs < imageEnd_; ofs += getRecordSize(h->size))
+    {
+        h = getHeader(ofs);
+        forEachRun(reinterpret_cast<const uint8_t *>(h + 1), h->size,
+                   [&](uint32_t o, const uint8_t *p, size_t len)
+                   { copyOverlap(buf, pos, size, p, o, len); });
+    }
+}
+
+void ConfigJournal::compact()
+{
+    flush();
+    if (!scanned_)
+    {
+        scan();
+    }
+    if (!valid_ || resident_ || !hasDelta())
+    {
+        return;
+    }
+
+    ImageSource source(*this);
+    DeltaSink sink(nullptr, nullptr, delta_, 0);
+    source.generate(sink);
+    beginCompact(source, sink.getSize(), sink.getCRC());
+    flush();
+
+    if (hasDelta())
+    {
+        makeResident();
+    }
+}
+
+// flash に FULL を書けないときは最新の内容を RAM に置いて, それを読ませる
+void ConfigJournal::makeResident()
+{
+    DPRINT(("journal: cannot compact. %d bytes on RAM\n", imageSize_));
+    image_.resize(imageSize_);
+    readImage(0, image_.data(), imageSize_);
+    resident_ = true;
+}
+
+bool ConfigJournal::hasDelta() const
+{
+    uint32_t top = bank_ * bankSize_;
+    return valid_ && imageEnd_ > top + getRecordSize(getHeader(top)->size);
+}
+
+bool ConfigJournal::write(Source &source)
+{
+    bool r = beginWrite(source);
+    flush();
+    return r;
+}
+
+bool ConfigJournal::beginWrite(Source &source)
+{
+    flush();
+    aborted_ = false;
+    verifyFailed_ = false;
+
+    if (!scanned_)
+    {
+        scan();
+    }
+
+    // 一度流してもらってサイズと CRC を調べ, 差分が小さければ DELTA も作る
+    DeltaSink sink(valid_ && !needCompact_ ? this : nullptr, readBuf_, delta_, MAX_DELTA_SIZE);
+    source.generate(sink);
+    sink.finish();
+
+    auto size = sink.getSize();
+    if (size > getMaxImageSize())
+    {
+        DPRINT(("journal: image too large %d\n", size));
+        releaseBuffers();
+        return false;
+    }
+
+    if (sink.isSame())
+    {
+        releaseBuffers();
+        return true;
+    }
+
+    if (!sink.isOverflow() && delta_.size() < size &&
+        writeOfs_ + getRecordSize(delta_.size()) <= (bank_ + 1) * bankSize_)
+    {
+        beginRecord(writeOfs_, RecordType::DELTA, delta_.size());
+        pendingHeader_.crc = util::crc32(recordCRC_, delta_.data(), delta_.size());
+        return true;
+    }
+
+    releaseBuffers();
+    beginCompact(source, size, sink.getCRC());
+    return true;
+}
+
+// 有効な FULL のうち新しい方のバンクから差分を当てていく
+void ConfigJournal::scan()
+{
+    scanned_ = true;
+    valid_ = false;
+    needCompact_ = false;
+    resident_ = false;
+    image_.clear();
+
+    int best = -1;
+    uint32_t bestSeq = 0;
+    for (int b = 0; b < 2; ++b)
+    {
+        uint32_t ofs = b * bankSize_;
+        if (isValidRecord(ofs, ofs + bankSize_) &&
+            getHeader(ofs)->type == static_cast<uint16_t>(RecordType::FULL))
+        {
+            auto seq = getHeader(ofs)->seq;
+            if (best < 0 || static_cast<int32_t>(seq - bestSeq) > 0)
+            {
+                best = b;
+                bestSeq = seq;
+            }
+        }
+    }
+    if (best < 0)
+    {
+        DPRINT(("journal: no valid bank\n"));
+        return;
+    }
+
+    bank_ = best;
+    uint32_t ofs = best * bankSize_;
+    uint32_t bankEnd = ofs + bankSize_;
+    {
+        auto *h = getHeader(ofs);
+        imageSize_ = h->size;
+        seq_ = h->seq;
+        ofs += getRecordSize(h->size);
+    }
+
+    int records = 1;
+    while (ofs + sizeof(RecordHeader) <= bankEnd)
+    {
+        auto *h = getHeader(ofs);
+        if (!isValidRecord(ofs, bankEnd) ||
+            h->seq != seq_ + 1 ||
+            h->type != static_cast<uint16_t>(RecordType::DELTA))
+        {
+            // セクタの途中は書き込み前に消去済みなので 0xff 以外は書きかけ
+            // セクタ先頭は書くときに消去するので何があっても良い
+            static constexpr uint8_t erased[sizeof(RecordHeader)] = {
+                0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff,
+                0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+            if ((ofs & (SECTOR_SIZE - 1)) && memcmp(h, erased, sizeof(erased)) != 0)
+            {
+                DPRINT(("journal: broken record at %x\n", ofs));
+                needCompact_ = true;
+            }
+            break;
+        }
+        int newSize = forEachRun(reinterpret_cast<const uint8_t *>(h + 1), h->size,
+                                 [](uint32_t, const uint8_t *, size_t) {});
+        if (newSize < 0)
+        {
+            DPRINT(("journal: bad delta at %x\n", ofs));
+            needCompact_ = true;
+            break;
+        }
+        imageSize_ = newSize;
+        seq_ = h->seq;
+        ofs += getRecordSize(h->size);
+        ++records;
+    }
+
+    writeOfs_ = imageEnd_ = ofs;
+    valid_ = true;
+    DPRINT(("journal: bank %d, %d records, %d bytes, next %x\n",
+            bank_, records, imageSize_, writeOfs_));
+}
+
+// もう一方のバンクに FULL を書いて切り替える
+// 古いバンクは次に使うときまで消さないので, 書き込み中に電源が落ちても前の内容が残る
+void ConfigJournal::beginCompact(Source &source, size_t size, uint32_t crc)
+{
+    // ジャーナルが無いときはバンク1から使う. バンク0には旧形式のデータがあるかもしれない
+    int bank = valid_ ? bank_ ^ 1 : 1;
+    beginRecord(bank * bankSize_, RecordType::FULL, size);
+
+    source_ = &source;
+    sourceCRC_ = crc;
+    window_.resize(SECTOR_SIZE);
+    if (!fillWindow(0))
+    {
+        abort();
+    }
+}
+
+// seq_ の次の番号でレコードを用意する. 書くのは step()
+// まだ入っていないセクタは書く前に消去する
+void ConfigJournal::beginRecord(uint32_t ofs, RecordType type, size_t size)
+{
+    auto recSize = getRecordSize(size);
+
+    eraseOfs_ = (ofs + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1);
+    eraseEnd_ = std::max<uint32_t>(eraseOfs_, (ofs + recSize + SECTOR_SIZE - 1) & ~(SECTOR_SIZE - 1));
+
+    pendingHeader_ = {MAGIC, seq_ + 1, static_cast<uint16_t>(type), static_cast<uint16_t>(size), 0};
+    recordCRC_ = util::crc32(0, &pendingHeader_, offsetof(RecordHeader, crc));
+
+    pendingBase_ = ofs;
+    pendingPage_ = 0;
+    pendingPageCount_ = recSize / PAGE_SIZE;
+    ++stats_.records;
+}
+
+// レコードの ofs から SECTOR_SIZE 分を source から作る
+// window は先頭から順に1回ずつ作るので, そのたびに CRC を進める
+bool ConfigJournal::fillWindow(uint32_t ofs)
+{
+    std::fill(window_.begin(), window_.end(), 0xff);
+    windowOfs_ = ofs;
+
+    WindowSink sink(window_.data(), ofs, window_.size(), sizeof(RecordHeader));
+    source_->generate(sink);
+    if (sink.getSize() != pendingHeader_.size || sink.getCRC() != sourceCRC_)
+    {
+        DPRINT(("journal: source changed\n"));
+        return false;
+    }
+
+    uint32_t b = std::max<uint32_t>(ofs, sizeof(RecordHeader));
+    uint32_t e = std::min<uint32_t>(ofs + window_.size(), sizeof(RecordHeader) + pendingHeader_.size);
+    if (b < e)
+    {
+        recordCRC_ = util::crc32(recordCRC_, window_.data() + (b - ofs), e - b);
+    }
+    if (ofs == 0)
+    {
+        memcpy(headPage_, window_.data(), PAGE_SIZE);
+    }
+    return true;
+}
+
+bool ConfigJournal::step(bool allowErase)
+{
+    if (!isBusy())
+    {
+        return false;
+    }
+
+    // 消去を先に全部済ませてから書く
+    if (eraseOfs_ < eraseEnd_)
+    {
+        if (allowErase)
+        {
+            flash_.erase(eraseOfs_, SECTOR_SIZE);
+            eraseOfs_ += SECTOR_SIZE;
+            ++stats_.erasedSectors;
+        }
+        return true;
+    }
+
+    const uint8_t *p;
+    uint32_t ofs;
+    if (pendingHeader_.type == static_cast<uint16_t>(RecordType::DELTA))
+    {
+        ofs = pendingPage_ * PAGE_SIZE;
+        std::fill(std::begin(page_), std::end(page_), 0xff);
+        const uint8_t *header = reinterpret_cast<const uint8_t *>(&pendingHeader_);
+        for (uint32_t i = 0; i < PAGE_SIZE; ++i)
+        {
+            uint32_t r = ofs + i;
+            if (r < sizeof(RecordHeader))
+            {
+                page_[i] = header[r];
+            }
+            else if (r - sizeof(RecordHeader) < delta_.size())
+            {
+                page_[i] = delta_[r - sizeof(RecordHeader)];
+            }
+        }
+        p = page_;
+    }
+    else
+    {
+        // ヘッダのある先頭ページは最後に書く. 途中で電源が落ちても有効なレコードにならない
+        ofs = (pendingPage_ + 1) % pendingPageCount_ * PAGE_SIZE;
+        if (ofs == 0)
+        {
+            pendingHeader_.crc = recordCRC_;
+            memcpy(headPage_, &pendingHeader_, sizeof(RecordHeader));
+            p = headPage_;
+        }
+        else
+        {
+            if (ofs >= windowOfs_ + window_.size())
+            {
+                // 次の window を作るだけで1回分とする
+                if (!fillWindow(ofs))
+                {
+                    abort();
+                    return false;
+                }
+                return true;
+            }
+            p = window_.data() + (ofs - windowOfs_);
+        }
+    }
+
+    flash_.program(pendingBase_ + ofs, p, PAGE_SIZE);
+    ++stats_.programmedPages;
+
+    if (++pendingPage_ < pendingPageCount_)
+    {
+        return true;
+    }
+    finishRecord();
+    return false;
+}
+
+// 書き終わったレコードを反映する
+void ConfigJournal::finishRecord()
+{
+    auto size = pendingHeader_.size;
+    uint32_t bankEnd = (pendingBase_ / bankSize_ + 1) * bankSize_;
+    if (!isValidRecord(pendingBase_, bankEnd))
+    {
+        // 書いた分は使わない
+        // DELTA の後ろには続けられないので次の書き込みで FULL を書きなおす
+        // FULL なら今のバンクはそのままなので DELTA を続けてよい
+        DPRINT(("journal: verify failed at %x\n", pendingBase_));
+        if (pendingHeader_.type == static_cast<uint16_t>(RecordType::DELTA))
+        {
+            needCompact_ = true;
+        }
+        abort(true);
+        return;
+    }
+
+    if (pendingHeader_.type == static_cast<uint16_t>(RecordType::DELTA))
+    {
+        imageSize_ = forEachRun(delta_.data(), delta_.size(),
+                                [&](uint32_t ofs, const uint8_t *p, size_t len)
+                                {
+                                    if (resident_)
+                                    {
+                                        image_.resize(std::max<size_t>(image_.size(), ofs + len));
+                                        memcpy(image_.data() + ofs, p, len);
+                                    }
+                                });
+        if (resident_)
+        {
+            image_.resize(imageSize_);
+        }
+    }
+    else
+    {
+        // 新しい内容は書いたものから読む
+        bank_ = pendingBase_ / bankSize_;
+        imageSize_ = size;
+        valid_ = true;
+        needCompact_ = false;
+        resident_ = false;
+        image_.clear();
+        image_.shrink_to_fit();
+        ++stats_.compactions;
+    }
+
+    seq_ = pendingHeader_.seq;
+    writeOfs_ = imageEnd_ = pendingBase_ + getRecordSize(size);
+    releaseBuffers();
+}
+
+// 書き込みをやめる. 書きかけの FULL はヘッダが無いので使われない
+void ConfigJournal::abort(bool verifyFailed)
+{
+    pendingPage_ = pendingPageCount_ = 0;
+    eraseOfs_ = eraseEnd_ = 0;
+    if (verifyFailed)
+    {
+        verifyFailed_ = true;
+        ++stats_.verifyFailures;
+    }
+    else
+    {
+        aborted_ = true;
+        ++stats_.aborts;
+    }
+    releaseBuffers();
+}
+
+void ConfigJournal::releaseBuffers()
+{
+    delta_.clear();
+    delta_.shrink_to_fit();
+    window_.clear();
+    window_.shrink_to_fit();
+    source_ = nullptr;
+}
+
+void ConfigJournal::flush()
+{
+    while (step())
+        ;
+}
+
+const ConfigJournal::RecordHeader *
+ConfigJournal::getHeader(uint32_t ofs) const
+{
+    return reinterpret_cast<const RecordHeader *>(flash_.getAddr() + ofs);
+}
+
+bool ConfigJournal::isValidRecord(uint32_t ofs, uint32_t bankEnd) const
+{
+    auto *h = getHeader(ofs);
+    if (h->magic != MAGIC || ofs + getRecordSize(h->size) > bankEnd)
+    {
+        return false;
+    }
+    auto crc = util::crc32(util::crc32(0, h, offsetof(RecordHeader, crc)), h + 1, h->size);
+    return crc == h->crc;
+}
+
+size_t
+ConfigJournal::getRecordSize(size_t payloadSize)
+{
+    return (sizeof(RecordHeader) + payloadSize + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+}
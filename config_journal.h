@@ -0,0 +1,184 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 10:12:37
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+// 設定を flash にジャーナル形式で書く
+// 領域を2つのバンクに分け, 先頭に全体 (FULL), 続けて前回との差分 (DELTA) を追記していく
+// バンクが一杯になったり差分が大きいときはもう一方のバンクに FULL を書いて切り替える
+// 書く内容は Source から流してもらい, 全体をメモリに持たない
+// 最新の内容も RAM には展開しない. FULL は flash 上をそのまま読み, DELTA があれば重ねながら読む
+// flash へのアクセスは Flash 経由なのでホストでも動く
+class ConfigJournal
+{
+public:
+    static constexpr size_t SECTOR_SIZE = 4096;
+    static constexpr size_t PAGE_SIZE = 256;
+    // これより大きい差分は DELTA にせず FULL を書く
+    static constexpr size_t MAX_DELTA_SIZE = SECTOR_SIZE;
+
+    class Flash
+    {
+    public:
+        virtual ~Flash() = default;
+        // 領域先頭のアドレス. 読み出しはここから直接行う
+        virtual const uint8_t *getAddr() const = 0;
+        // ofs は領域先頭から. erase は SECTOR_SIZE, program は PAGE_SIZE 単位
+        virtual void erase(uint32_t ofs, size_t size) = 0;
+        virtual void program(uint32_t ofs, const uint8_t *p, size_t size) = 0;
+    };
+
+    class Sink
+    {
+    public:
+        virtual ~Sink() = default;
+        virtual void write(const uint8_t *p, size_t size) = 0;
+    };
+
+    // 書く内容. 書き終わるまでに何度か呼ばれるので, 毎回同じ内容を先頭から出力すること
+    // 途中で内容が変わったら書き込みをやめる
+    class Source
+    {
+    public:
+        virtual ~Source() = default;
+        virtual void generate(Sink &sink) = 0;
+    };
+
+    struct Stats
+    {
+        uint32_t records = 0;
+        uint32_t compactions = 0;
+        uint32_t aborts = 0;
+        uint32_t verifyFailures = 0;
+        uint32_t erasedSectors = 0;
+        uint32_t programmedPages = 0;
+    };
+
+public:
+    // regionSize は SECTOR_SIZE * 2 の倍数
+    ConfigJournal(Flash &flash, size_t regionSize);
+
+    // 最新の内容が flash 上で続けて読めるとき (後ろに DELTA が無いとき) はその先頭
+    // DELTA があるときとジャーナルが無いときは nullptr
+    // 次の書き込みが終わるまで有効
+    const uint8_t *getImage(size_t &size);
+
+    // 最新の内容の [pos, pos + size) を読む. DELTA があれば重ねる. 内容の外は 0xff
+    void readImage(uint32_t pos, uint8_t *buf, size_t size);
+    // 最新の内容のサイズ. ジャーナルが無ければ 0
+    size_t getImageSize();
+
+    // DELTA があれば最新の内容で FULL を書きなおして getImage() で読めるようにする
+    // 書き終わるまで戻らないので, 起動時など消去で止まってよいときに呼ぶ
+    // 書けなかったときは RAM に展開する
+    void compact();
+
+    // source の内容を書く. 前回と同じなら何もしない
+    // 書き終わるまで戻らない
+    bool write(Source &source);
+
+    // 書き込みを始めるだけ. 実際の flash 操作は step() で1つずつ行う
+    // 差分が小さければここで DELTA を作る
+    // 大きければ FULL を SECTOR_SIZE ずつ source から作りながら書くので, source は書き終わるまで残しておく
+    // 前の書き込みが残っていたら先に終わらせる
+    bool beginWrite(Source &source);
+
+    // セクタ消去かページ書き込みを1つ進める
+    // allowErase が false なら消去の手前で待つ
+    // 書き込みが残っていれば true
+    bool step(bool allowErase = true);
+    void flush();
+    bool isBusy() const { return pendingPage_ < pendingPageCount_; }
+    // 直前の書き込みを内容が変わったので途中でやめた
+    bool isAborted() const { return aborted_; }
+    // 直前の書き込みを読み返したら合わなかった. 同じ場所に書きなおしても直らないかもしれない
+    bool isVerifyFailed() const { return verifyFailed_; }
+
+    // 書ける最大サイズ
+    // FULL が1つのバンクに収まらなければならないので, 領域の半分からヘッダを引いたもの
+    size_t getMaxImageSize() const;
+
+    const Stats &getStats() const { return stats_; }
+
+protected:
+    struct RecordHeader
+    {
+        uint32_t magic;
+        uint32_t seq;
+        uint16_t type;
+        uint16_t size; // payload のバイト数
+        uint32_t crc;  // crc 以外のヘッダと payload
+    };
+
+    enum class RecordType : uint16_t
+    {
+        FULL = 1,
+        DELTA = 2,
+    };
+
+    static constexpr uint32_t MAGIC = 'E' | ('A' << 8) | ('J' << 16) | ('R' << 24);
+
+    void scan();
+    bool hasDelta() const;
+    void makeResident();
+
+    void beginRecord(uint32_t ofs, RecordType type, size_t size);
+    void beginCompact(Source &source, size_t size, uint32_t crc);
+    bool fillWindow(uint32_t ofs);
+    void finishRecord();
+    void abort(bool verifyFailed = false);
+    void releaseBuffers();
+
+    const RecordHeader *getHeader(uint32_t ofs) const;
+    bool isValidRecord(uint32_t ofs, uint32_t bankEnd) const;
+
+    static size_t getRecordSize(size_t payloadSize);
+
+private:
+    Flash &flash_;
+    size_t bankSize_;
+
+    bool scanned_ = false;
+    bool valid_ = false;
+    bool needCompact_ = false; // 壊れたレコードがあった
+    int bank_ = 0;
+    uint32_t writeOfs_ = 0; // 次のレコードの位置 (領域先頭から)
+    uint32_t imageEnd_ = 0; // 最新の内容に含まれるレコードの終わり
+    uint32_t seq_ = 0;      // 最後のレコードの seq
+    size_t imageSize_ = 0;
+
+    // flash に FULL を書けなかったときだけ最新の内容を展開しておく
+    bool resident_ = false;
+    std::vector<uint8_t> image_;
+
+    // 書き込み途中のレコード
+    // DELTA は先頭から, FULL はヘッダのある先頭ページを最後に書く
+    RecordHeader pendingHeader_{};
+    uint32_t pendingBase_ = 0;      // 書き先 (領域先頭から)
+    uint32_t pendingPage_ = 0;      // 書いたページ数
+    uint32_t pendingPageCount_ = 0;
+    uint32_t eraseOfs_ = 0; // 次に消すセクタ
+    uint32_t eraseEnd_ = 0;
+    bool aborted_ = false;
+    bool verifyFailed_ = false;
+
+    // DELTA の payload
+    std::vector<uint8_t> delta_;
+
+    // FULL の内容は window_ に SECTOR_SIZE ずつ作る
+    Source *source_ = nullptr;
+    uint32_t sourceCRC_ = 0;   // beginWrite() で読んだ内容の CRC
+    std::vector<uint8_t> window_;
+    uint32_t windowOfs_ = 0;   // window_ のレコード先頭からの位置
+    uint32_t recordCRC_ = 0;   // window_ を作るたびに進める
+    uint8_t headPage_[PAGE_SIZE]; // 先頭ページ
+    uint8_t page_[PAGE_SIZE];     // DELTA の書き込み用
+    uint8_t readBuf_[PAGE_SIZE];  // DELTA を作るときに前回の内容を読む
+
+    Stats stats_;
+};
@@ -0,0 +1,108 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 10:14:52
+ */
+
+#include "dac_table.h"
+#include <array>
+#include <algorithm>
+
+namespace
+{
+    // constexpr で使える exp
+    constexpr double cexp(double x)
+    {
+        // x = n log2 + r, |r| <= log2/2 にして Taylor 展開
+        constexpr double LOG2 = 0.69314718055994530942;
+        int n = static_cast<int>(x / LOG2 + (x < 0 ? -0.5 : 0.5));
+        double r = x - n * LOG2;
+
+        double term = 1;
+        double sum = 1;
+        for (int i = 1; i < 20; ++i)
+        {
+            term *= r / i;
+            sum += term;
+        }
+
+        for (; n > 0; --n)
+        {
+            sum *= 2;
+        }
+        for (; n < 0; ++n)
+        {
+            sum *= 0.5;
+        }
+        return sum;
+    }
+
+    constexpr int cclamp(int v, int lo, int hi)
+    {
+        return v < lo ? lo : (v > hi ? hi : v);
+    }
+
+    constexpr auto makeLevelTable()
+    {
+        std::array<uint16_t, DAC_TABLE_SIZE> t{};
+        for (int i = 0; i < DAC_TABLE_SIZE; ++i)
+        {
+            double v = i * 5.0 / 1024;
+            double y = (1.422 * v * v * v - 9.613 * v * v - 33.06 * v + 233.496) / 256.0;
+            t[i] = cclamp(static_cast<int>(y * 1023 * 16 + 0.5), 0, 1023 * 16);
+        }
+        return t;
+    }
+
+    // カーブは原点対称なので正の側 (中心から 0..512) だけを持つ
+    inline constexpr int HALF_SIZE = DAC_TABLE_SIZE / 2 + 1;
+    inline constexpr int N_SENSITIVITIES = DAC_SENSITIVITY_MAX - DAC_SENSITIVITY_MIN + 1;
+
+    using HalfCurve = std::array<int16_t, HALF_SIZE>;
+
+    constexpr HalfCurve makeHalfCurve(int sensitivity)
+    {
+        HalfCurve t{};
+        if (sensitivity == 0)
+        {
+            for (int i = 0; i < HALF_SIZE; ++i)
+            {
+                t[i] = i * 2;
+            }
+            return t;
+        }
+
+        double d = 1.0 / (1.0 - cexp(-sensitivity));
+        for (int i = 0; i < HALF_SIZE; ++i)
+        {
+            double y = (1.0 - cexp(-sensitivity * (i / 512.0))) * d;
+            t[i] = cclamp(static_cast<int>(y * 1024), -1024, 1024);
+        }
+        return t;
+    }
+
+    constexpr auto makeSensCurves()
+    {
+        std::array<HalfCurve, N_SENSITIVITIES> t{};
+        for (int s = 0; s < N_SENSITIVITIES; ++s)
+        {
+            t[s] = makeHalfCurve(s + DAC_SENSITIVITY_MIN);
+        }
+        return t;
+    }
+
+    constexpr auto levelTable_ = makeLevelTable();
+    constexpr auto sensCurves_ = makeSensCurves();
+}
+
+int getDACLevel(int v)
+{
+    return levelTable_[std::clamp(v, 0, DAC_TABLE_SIZE - 1)];
+}
+
+int getDACSensCurve(int sensitivity, int v)
+{
+    const auto &c = sensCurves_[std::clamp(sensitivity, DAC_SENSITIVITY_MIN, DAC_SENSITIVITY_MAX) -
+                                DAC_SENSITIVITY_MIN];
+    int i = v - DAC_TABLE_SIZE / 2;
+    return i >= 0 ? c[std::min(i, HALF_SIZE - 1)] : -c[std::min(-i, HALF_SIZE - 1)];
+}
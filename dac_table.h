@@ -0,0 +1,21 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 10:12:30
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// アナログ出力用のテーブル. すべてコンパイル時に生成して flash に置く
+
+inline constexpr int DAC_TABLE_SIZE = 1025;
+inline constexpr int DAC_SENSITIVITY_MIN = -16;
+inline constexpr int DAC_SENSITIVITY_MAX = 16;
+
+// 0..1024 の値を PWM のレベルにする
+// ディザリングするので 1/16 カウント単位 (0..1023*16)
+int getDACLevel(int v);
+
+// 感度カーブ. v: 0..1024 (中心 512), 戻り値 -1024..1024
+int getDACSensCurve(int sensitivity, int v);
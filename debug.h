@@ -7,11 +7,25 @@
 
 #include <cstdio>
 
+// ENABLE_ASYNC_LOG なら logger に積んで後で DMA で送る (logger.h)
+// 引数は整数かポインタだけ. %s は消えない文字列を渡すこと
+#ifdef ENABLE_ASYNC_LOG
+#include "logger.h"
+#define LOG(x) logger::print x
+#define LOG_FLUSH() logger::flush()
+#else
+#define LOG(x) printf x
+#define LOG_FLUSH() \
+    do              \
+    {               \
+    } while (0)
+#endif
+
 #ifdef NDEBUG
 #define DPRINT(x) \
     do            \
     {             \
     } while (0)
 #else
-#define DPRINT(x) printf x
+#define DPRINT(x) LOG(x)
 #endif
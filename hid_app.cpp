@@ -13,6 +13,8 @@
 #include "util.h"
 #include "hid_info.h"
 #include "debug.h"
+#include "mem_stat.h"
+#include "trace.h"
 
 #include <host/hub.h>
 
@@ -42,6 +44,35 @@ namespace
     inline constexpr uint8_t HUB1_ADDR = CFG_TUH_DEVICE_MAX + 2; // ポートに差しているHUB
 
     std::array<HIDInfo, CFG_TUH_DEVICE_MAX> hidInfos_; // devaddr毎のHIDInfo
+
+    // devaddr 毎に preloadConfig() した回数 (HID はインスタンスごとに呼ばれる)
+    // 切断時に同じ回数 releaseConfig() する
+    struct PreloadedConfig
+    {
+        uint16_t vid;
+        uint16_t pid;
+        int count = 0;
+    };
+    std::array<PreloadedConfig, CFG_TUH_DEVICE_MAX> preloadedConfigs_;
+
+    void preloadConfig(uint8_t dev_addr, uint16_t vid, uint16_t pid)
+    {
+        auto &pc = preloadedConfigs_[dev_addr - 1];
+        pc.vid = vid;
+        pc.pid = pid;
+        ++pc.count;
+        PadManager::instance().preloadConfig(vid, pid);
+    }
+
+    void releaseConfig(uint8_t dev_addr)
+    {
+        auto &pc = preloadedConfigs_[dev_addr - 1];
+        if (pc.count)
+        {
+            --pc.count;
+            PadManager::instance().releaseConfig(pc.vid, pc.pid);
+        }
+    }
     descriptor_hub_desc_t extHubDesc_;                 // 追加HUBのdescriptor
 
     uint8_t hub0Port_[HUB0_PORT_COUNT]{0, 1};
@@ -84,6 +115,16 @@ namespace
         return r;
     }
 
+    // 接続, 切断したポートの入力を戻す. エンコーダの原点も取り直す
+    void resetPort(uint8_t dev_addr)
+    {
+        int port = getControllerPortID(dev_addr);
+        if (port >= 0 && port < MAX_PORTS)
+        {
+            PadManager::instance().resetLatestPadData(port);
+        }
+    }
+
     void checkExtHubCb(tuh_xfer_t *xfer)
     {
         if (XFER_RESULT_SUCCESS != xfer->result)
@@ -150,6 +191,7 @@ namespace
 
 extern "C" void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t const *desc_report, uint16_t desc_len)
 {
+    MEMSTAT_SCOPE(HID);
     assert(dev_addr >= 1);
 
     uint16_t vid, pid;
@@ -174,6 +216,7 @@ extern "C" void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t con
         hidInfo.setVID(vid);
         hidInfo.setPID(pid);
         PadManager::instance().resetLatestPadData(port);
+        preloadConfig(dev_addr, vid, pid);
     }
 
     if (!tuh_hid_receive_report(dev_addr, instance))
@@ -185,13 +228,17 @@ extern "C" void tuh_hid_mount_cb(uint8_t dev_addr, uint8_t instance, uint8_t con
 extern "C" void tuh_hid_umount_cb(uint8_t dev_addr, uint8_t instance)
 {
     DPRINT(("HID device address = %d, instance = %d is unmounted\n", dev_addr, instance));
+    releaseConfig(dev_addr);
+    resetPort(dev_addr);
 }
 
 extern "C" void tuh_hid_report_received_cb(uint8_t dev_addr,
                                            uint8_t instance, uint8_t const *report, uint16_t len)
 {
+    MEMSTAT_SCOPE(INPUT);
     assert(dev_addr >= 1);
     int port = getControllerPortID(dev_addr);
+    TRACE(HID_REPORT, port, len, dev_addr << 8 | instance);
 
     // printf("report received: addr:%d, inst %d, port %d\n", dev_addr, instance, port);
     // util::dumpBytes(report, len);
@@ -204,7 +251,8 @@ extern "C" void tuh_hid_report_received_cb(uint8_t dev_addr,
         padInput.vid = hidInfo.getVID();
         padInput.pid = hidInfo.getPID();
         hidInfo.parseReport(report, len,
-                            padInput.buttons[0], padInput.hat, padInput.analogs);
+                            padInput.buttons[0], padInput.hat, padInput.analogs,
+                            padInput.relatives);
         PadManager::instance().setData(port, padInput);
     }
 
@@ -227,11 +275,13 @@ extern "C"
 
     void tuh_xinput_report_received_cb(uint8_t dev_addr, uint8_t instance, const xinputh_interface_t *xid_itf, uint16_t len)
     {
+        MEMSTAT_SCOPE(INPUT);
         auto *p = &xid_itf->pad;
 
         if (xid_itf->connected && xid_itf->new_pad_data)
         {
             int port = getControllerPortID(dev_addr);
+            TRACE(XINPUT_REPORT, port, len, dev_addr << 8 | instance);
 
             uint16_t vid, pid;
             tuh_vid_pid_get(dev_addr, &vid, &pid);
@@ -261,11 +311,14 @@ extern "C"
 
     void tuh_xinput_mount_cb(uint8_t dev_addr, uint8_t instance, const xinputh_interface_t *xinput_itf)
     {
+        MEMSTAT_SCOPE(HID);
         uint16_t vid, pid;
         tuh_vid_pid_get(dev_addr, &vid, &pid);
 
         DPRINT(("XINPUT device address = %d, instance = %d is mounted\n", dev_addr, instance));
         DPRINT(("VID = %04x, PID = %04x\r\n", vid, pid));
+        preloadConfig(dev_addr, vid, pid);
+        resetPort(dev_addr);
 
         if (xinput_itf->connected ||
             xinput_itf->type != XBOX360_WIRELESS)
@@ -299,6 +352,8 @@ extern "C"
     void tuh_xinput_umount_cb(uint8_t dev_addr, uint8_t instance)
     {
         DPRINT(("XINPUT device address = %d, instance = %d is unmounted\n", dev_addr, instance));
+        releaseConfig(dev_addr);
+        resetPort(dev_addr);
     }
 }
 
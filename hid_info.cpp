@@ -53,8 +53,10 @@ namespace
 
 void HIDInfo::Report::dump() const
 {
-    DPRINT(("usage = %08x, ofs = %d, bits = %d, min = %d, max = %d, const = %d, array = %d, nullable = %d\n",
-            usage_, bitOfs_, bits_, min_, max_, isConst_, isArray_, isNullable_));
+    DPRINT(("usage = %08x, ofs = %d, bits = %d, min = %d, max = %d, ",
+            usage_, bitOfs_, bits_, min_, max_));
+    DPRINT(("const = %d, array = %d, nullable = %d, relative = %d\n",
+            isConst_, isArray_, isNullable_, isRelative_));
 }
 
 void HIDInfo::ReportSet::dump() const
@@ -240,6 +242,7 @@ void HIDInfo::parseDesc(const uint8_t *p, const uint8_t *tail,
             bool isConst = value & CONSTANT;
             bool isArray = !(value & VARIABLE);
             bool isNullable = value & NULL_STATE;
+            bool isRelative = value & RELATIVE;
 
             int ofs = bitOfs;
             int ct = state.reportCount;
@@ -263,6 +266,7 @@ void HIDInfo::parseDesc(const uint8_t *p, const uint8_t *tail,
                             r.isConst_ = isConst;
                             r.isArray_ = isArray;
                             r.isNullable_ = isNullable;
+                            r.isRelative_ = isRelative;
                         }
                         ofs += bitStep;
                     }
@@ -294,6 +298,7 @@ void HIDInfo::parseDesc(const uint8_t *p, const uint8_t *tail,
                         r.isConst_ = isConst;
                         r.isArray_ = isArray;
                         r.isNullable_ = isNullable;
+                        r.isRelative_ = isRelative;
                     }
                     ofs += bitStep;
                 }
@@ -483,11 +488,13 @@ void HIDInfo::parseDesc(const uint8_t *p, const uint8_t *tail,
 void HIDInfo::parseReport(const uint8_t *p, size_t size,
                           uint32_t &buttons,
                           int &hat,
-                          std::array<int, N_ANALOGS> &analogs) const
+                          std::array<int, N_ANALOGS> &analogs,
+                          std::array<int, N_ANALOGS> &relatives) const
 {
     buttons = 0;
     hat = -1;
     analogs = {};
+    relatives = {};
 
     if (reportSets_.empty())
     {
@@ -553,13 +560,21 @@ void HIDInfo::parseReport(const uint8_t *p, size_t size,
         else if (int analogID = r.getAnalogIndex(); analogID >= 0)
         {
             int32_t v = getBits(r.bitOfs_, r.bits_);
-            if (r.min_ < 0)
+            if (r.min_ < 0 || r.isRelative_)
             {
                 // 符号拡張の条件はこれで良いのか？
                 int s = 32 - r.bits_;
                 v = (v << s) >> s;
             }
 
+            if (r.isRelative_)
+            {
+                // 移動量はそのまま渡す. 絶対値としては中央
+                relatives[analogID] += v;
+                analogs[analogID] = 128;
+                continue;
+            }
+
             v = std::clamp<int>((v - r.min_) * 255 / (r.max_ - r.min_), 0, 255);
             analogs[analogID] = v;
         }
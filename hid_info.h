@@ -6,6 +6,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstddef>
 #include <vector>
 #include <map>
 #include <array>
@@ -25,6 +26,7 @@ public:
         bool isConst_ = false;
         bool isArray_ = false;
         bool isNullable_ = false;
+        bool isRelative_ = false; // マウスやトラックボールの移動量
 
         bool isButton() const { return (usage_ >> 16) == 0x09; }
         bool isHat() const { return usage_ == 0x00010039; }
@@ -69,10 +71,13 @@ public:
                    bool enableUnknowns = false,
                    bool enableOutput = false, bool enableFeature = false);
 
+    // relatives には相対軸の移動量 (カウント) が入る
+    // 相対軸の analogs は中央値になる
     void parseReport(const uint8_t *p, size_t size,
                      uint32_t &buttons,
                      int &hat,
-                     std::array<int, N_ANALOGS> &analogs) const;
+                     std::array<int, N_ANALOGS> &analogs,
+                     std::array<int, N_ANALOGS> &relatives) const;
 
     void setVID(int vid) { vid_ = vid; }
     void setPID(int pid) { pid_ = pid; }
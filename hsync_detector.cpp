@@ -0,0 +1,166 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sat Oct 17 2026 21:18:40
+ */
+
+#include "hsync_detector.h"
+#include <pico.h>
+#include <algorithm>
+#include <atomic>
+#include <stdio.h>
+
+namespace
+{
+    // 4byte をまとめて読むための型
+    typedef uint32_t __attribute__((__may_alias__)) Word;
+
+    // 4bit 中の最下位ビットの位置
+    // flash 操作中も DMA IRQ から読むので RAM に置く
+    const uint8_t __not_in_flash("hsync") lowestBit4_[16] = {0, 0, 1, 0, 2, 0, 1, 0, 3, 0, 1, 0, 2, 0, 1, 0};
+}
+
+void HSyncDetector::reset()
+{
+    lastPos_ = 0;
+    prevBit_ = 0;
+    acc_ = {};
+    buffers_ = 0;
+    minInterval_ = MIN_INTERVAL;
+    maxInterval_ = MAX_INTERVAL;
+
+    prevMeasureCount_ = measureCount_;
+    linePeriodQ8_ = 0;
+    lines2_ = 0;
+}
+
+// DMA IRQ から呼ばれるので RAM に置く
+void __not_in_flash_func(HSyncDetector::update)(const uint8_t *p, int n, int threshold)
+{
+    // 4サンプルずつ 7bit にしてしきい値と比べ, 結果を 4bit にまとめる
+    const uint32_t th = ((threshold >> 1) & 0x7f) * 0x01010101u;
+    const int minIv = minInterval_;
+    const int maxIv = maxInterval_;
+
+    auto *pw = reinterpret_cast<const Word *>(p);
+    int lastPos = lastPos_;
+    uint32_t prev = prevBit_;
+    auto acc = acc_;
+
+    for (int i = 0; i < n; i += 4)
+    {
+        uint32_t y = (*pw++ >> 1) & 0x7f7f7f7f;
+        uint32_t ge = ((y | 0x80808080) - th) & 0x80808080;
+        uint32_t m = ((ge >> 7) * 0x10204080) >> 28;
+
+        // 同期レベルに入ったところ
+        uint32_t r = m & ~((m << 1) | prev);
+        prev = m >> 3;
+
+        if (r)
+        {
+            int pos = i + lowestBit4_[r];
+            int iv = pos - lastPos;
+            lastPos = pos;
+            ++acc.edges;
+            if (iv >= minIv && iv <= maxIv)
+            {
+                acc.sum += iv;
+                ++acc.count;
+            }
+        }
+    }
+
+    // std::max は flash 上に実体ができることがあるので使わない
+    lastPos_ = lastPos - n > -MAX_INTERVAL - 1 ? lastPos - n : -MAX_INTERVAL - 1;
+    prevBit_ = prev;
+
+    if (++buffers_ < PUBLISH_BUFFERS)
+    {
+        acc_ = acc;
+        return;
+    }
+
+    measure_ = acc;
+    std::atomic_signal_fence(std::memory_order_release);
+    measureCount_ = measureCount_ + 1;
+
+    acc_ = {};
+    buffers_ = 0;
+}
+
+void HSyncDetector::updateMeasure(uint32_t fieldPeriodQ8)
+{
+    Measure m;
+    uint32_t ct;
+    do
+    {
+        ct = measureCount_;
+        std::atomic_signal_fence(std::memory_order_acquire);
+        m = measure_;
+        std::atomic_signal_fence(std::memory_order_acquire);
+    } while (ct != measureCount_);
+
+    if (ct == prevMeasureCount_)
+    {
+        return;
+    }
+    prevMeasureCount_ = ct;
+
+    // 半分以上のエッジが範囲内なら信用する
+    if (m.count == 0 || m.count * 2 < m.edges)
+    {
+        // 範囲を広げて捕まえなおす
+        // VSync 中の等化パルスで平均は少し短めになるが, 次の回で範囲外になる
+        linePeriodQ8_ = 0;
+        lines2_ = 0;
+        minInterval_ = MIN_INTERVAL;
+        maxInterval_ = MAX_INTERVAL;
+        return;
+    }
+
+    linePeriodQ8_ = uint64_t(m.sum) * samplePeriodNs_ * 256 / (uint64_t(m.count) * 1000);
+
+    // 次回は ±1/8 の範囲だけを採用する
+    int center = (m.sum + m.count / 2) / m.count;
+    minInterval_ = std::max<int>(MIN_INTERVAL, center - (center >> 3));
+    maxInterval_ = std::min<int>(MAX_INTERVAL, center + (center >> 3));
+
+    lines2_ = fieldPeriodQ8 ? (uint64_t(fieldPeriodQ8) * 2 + (linePeriodQ8_ >> 1)) / linePeriodQ8_ : 0;
+}
+
+int HSyncDetector::getLineFreq100Hz() const
+{
+    return linePeriodQ8_ ? (10000 * 256 + (linePeriodQ8_ >> 1)) / linePeriodQ8_ : 0;
+}
+
+int HSyncDetector::getLinesPerFrame() const
+{
+    // インターレースは2フィールドで1フレーム
+    return isInterlace() ? lines2_ : lines2_ >> 1;
+}
+
+std::array<char, 6> HSyncDetector::getLineFreqString() const
+{
+    std::array<char, 6> buf;
+    int f = getLineFreq100Hz();
+    if (f == 0 || f > 999)
+    {
+        buf = {'-', '-', '.', '-', 'k', 0};
+        return buf;
+    }
+    snprintf(buf.data(), buf.size(), "%2d.%dk", f / 10, f % 10);
+    return buf;
+}
+
+std::array<char, 6> HSyncDetector::getLinesString() const
+{
+    std::array<char, 6> buf;
+    int lines = getLinesPerFrame();
+    if (lines == 0 || lines > 9999)
+    {
+        buf = {' ', '-', '-', '-', '-', 0};
+        return buf;
+    }
+    snprintf(buf.data(), buf.size(), "%4d%c", lines, isInterlace() ? 'i' : 'p');
+    return buf;
+}
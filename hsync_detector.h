@@ -0,0 +1,67 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sat Oct 17 2026 21:05:12
+ */
+#pragma once
+
+#include <stdint.h>
+#include <array>
+
+// CSync の ADC サンプルから水平同期の周期を測る
+// VSyncDetector と同じバッファを DMA IRQ で受け取る
+class HSyncDetector
+{
+    // ISR -> main loop
+    struct Measure
+    {
+        uint32_t sum;   // 採用した間隔の合計 (サンプル数)
+        uint32_t count; // 採用した間隔の数
+        uint32_t edges; // 検出したエッジの総数
+    };
+
+    // ISR 側
+    int lastPos_ = 0; // 直前のエッジの位置 (バッファ先頭からのサンプル数. 負)
+    uint32_t prevBit_ = 0;
+    Measure acc_{};
+    int buffers_ = 0;
+
+    // 採用する間隔の範囲. main loop が設定する
+    volatile int minInterval_ = MIN_INTERVAL;
+    volatile int maxInterval_ = MAX_INTERVAL;
+
+    Measure measure_{};
+    volatile uint32_t measureCount_ = 0;
+
+    // 以下 main loop 側
+    int samplePeriodNs_ = 2000;
+    uint32_t prevMeasureCount_ = 0;
+
+    uint32_t linePeriodQ8_ = 0; // 1/256 us. 0 なら未検出
+    int lines2_ = 0;            // 1フィールドのライン数の2倍
+
+    static constexpr int MIN_INTERVAL = 8;  // サンプル (16us, 62.5kHz)
+    static constexpr int MAX_INTERVAL = 80; // サンプル (160us, 6.25kHz)
+    static constexpr int PUBLISH_BUFFERS = 16;
+
+public:
+    void reset();
+
+    // DMA IRQ から呼ばれる
+    // p は 4byte 境界, n は 4 の倍数であること
+    // threshold はサンプル値のしきい値
+    void update(const uint8_t *p, int n, int threshold);
+
+    // main loop から呼ぶ
+    // fieldPeriodQ8 は VSync の周期 (1/256 us)
+    void updateMeasure(uint32_t fieldPeriodQ8);
+
+    void setSamplePeriodNs(int ns) { samplePeriodNs_ = ns; }
+
+    uint32_t getLinePeriodQ8() const { return linePeriodQ8_; }
+    int getLineFreq100Hz() const;
+    int getLinesPerFrame() const;
+    bool isInterlace() const { return lines2_ & 1; }
+
+    std::array<char, 6> getLineFreqString() const;
+    std::array<char, 6> getLinesString() const;
+};
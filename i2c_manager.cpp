@@ -4,6 +4,7 @@
  */
 
 #include "i2c_manager.h"
+#include "trace.h"
 
 namespace
 {
@@ -81,6 +82,7 @@ bool I2CManager::sendNonBlocking(int priority,
         }
         i2c_->hw->data_cmd = data[size - 1] | (cont ? 0 : I2C_IC_DATA_CMD_STOP_BITS);
         priorityThreshold_ = 0;
+        TRACE(I2C_SEND, addr, size);
         return true;
     }
     return false;
@@ -105,20 +107,25 @@ void I2CManager::sendNonBlockingUnsafe(uint8_t addr, const uint8_t *data, size_t
         }
         i2c_->hw->data_cmd = data[size - 1] | (cont ? 0 : I2C_IC_DATA_CMD_STOP_BITS);
         priorityThreshold_ = 0;
+        TRACE(I2C_SEND, addr, size);
     }
 }
 
 void I2CManager::sendBlocking(uint8_t addr, const uint8_t *data, size_t size, bool cont)
 {
     wait(i2c_);
+    TRACE(I2C_BEGIN, addr, size, 0);
     i2c_write_blocking(i2c_, addr, data, size, cont);
+    TRACE(I2C_END, addr);
     resetAddr();
 }
 
 int I2CManager::readBlocking(uint8_t addr, uint8_t *data, size_t size)
 {
     wait(i2c_);
+    TRACE(I2C_BEGIN, addr, size, 1);
     int r = i2c_read_blocking(i2c_, addr, data, size, false);
+    TRACE(I2C_END, addr);
     resetAddr();
     return r;
 }
@@ -0,0 +1,183 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 19:02:31
+ */
+
+#include "logger.h"
+
+#ifdef ENABLE_ASYNC_LOG
+
+#include <pico/stdlib.h>
+#include <hardware/dma.h>
+#include <hardware/sync.h>
+#include <hardware/uart.h>
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+
+namespace logger
+{
+    namespace
+    {
+        struct Entry
+        {
+            const char *fmt; // nullptr なら args に入れたバイト列
+            uintptr_t args[MAX_ARGS];
+            uint8_t n;
+        };
+
+        // 1行の整形後の最大. 長い分は切れる
+        constexpr size_t LINE_SIZE = 128;
+        // CRLF にしても必ず1行は入る大きさ
+        constexpr size_t TX_BUFFER_SIZE = 512;
+
+        Entry entries_[N_ENTRIES];
+        volatile uint32_t head_ = 0; // 書き込んだ数
+        volatile uint32_t tail_ = 0; // 送った数
+        volatile uint32_t dropped_ = 0;
+        uint32_t reportedDropped_ = 0;
+
+        int dmaCh_ = -1;
+        char txBuffer_[TX_BUFFER_SIZE];
+
+        static_assert((N_ENTRIES & (N_ENTRIES - 1)) == 0);
+        static_assert(TX_BUFFER_SIZE >= LINE_SIZE * 2);
+
+        void pushEntry(const Entry &e)
+        {
+            auto irq = save_and_disable_interrupts();
+            if (head_ - tail_ < N_ENTRIES)
+            {
+                entries_[head_ & (N_ENTRIES - 1)] = e;
+                ++head_;
+            }
+            else
+            {
+                ++dropped_;
+            }
+            restore_interrupts(irq);
+        }
+
+        int format(char *buf, const Entry &e)
+        {
+            if (!e.fmt)
+            {
+                static constexpr char hex[] = "0123456789abcdef";
+                auto *p = reinterpret_cast<const uint8_t *>(e.args);
+                int n = 0;
+                for (int i = 0; i < e.n; ++i)
+                {
+                    buf[n++] = hex[p[i] >> 4];
+                    buf[n++] = hex[p[i] & 15];
+                    buf[n++] = ' ';
+                }
+                buf[n++] = '\n';
+                return n;
+            }
+
+            // 引数の数によらず全部渡す. 余った分は読まれない
+            // ARM では int もポインタも 32bit なのでそのまま %d, %s に渡せる
+            auto &a = e.args;
+            int n = snprintf(buf, LINE_SIZE, e.fmt, a[0], a[1], a[2], a[3], a[4], a[5]);
+            return n < 0 ? 0 : std::min<int>(n, LINE_SIZE - 1);
+        }
+
+        // LF を CRLF にして詰める. stdio の変換と合わせる
+        size_t append(size_t pos, const char *s, int n)
+        {
+            for (int i = 0; i < n; ++i)
+            {
+                if (s[i] == '\n' && (pos == 0 || txBuffer_[pos - 1] != '\r'))
+                {
+                    txBuffer_[pos++] = '\r';
+                }
+                txBuffer_[pos++] = s[i];
+            }
+            return pos;
+        }
+    }
+
+    void init()
+    {
+        dmaCh_ = dma_claim_unused_channel(true);
+
+        auto cfg = dma_channel_get_default_config(dmaCh_);
+        channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
+        channel_config_set_read_increment(&cfg, true);
+        channel_config_set_write_increment(&cfg, false);
+        channel_config_set_dreq(&cfg, uart_get_index(uart_default) ? DREQ_UART1_TX : DREQ_UART0_TX);
+        dma_channel_configure(dmaCh_, &cfg,
+                              &uart_get_hw(uart_default)->dr, txBuffer_, 0, false);
+    }
+
+    void update()
+    {
+        if (dmaCh_ < 0 || dma_channel_is_busy(dmaCh_))
+        {
+            return;
+        }
+
+        char line[LINE_SIZE];
+        size_t size = 0;
+
+        uint32_t dropped = dropped_;
+        if (dropped != reportedDropped_)
+        {
+            int n = snprintf(line, sizeof(line), "log: %u dropped\n",
+                             (unsigned)(dropped - reportedDropped_));
+            size = append(size, line, n);
+            reportedDropped_ = dropped;
+        }
+
+        while (tail_ != head_ && TX_BUFFER_SIZE - size >= LINE_SIZE * 2)
+        {
+            int n = format(line, entries_[tail_ & (N_ENTRIES - 1)]);
+            size = append(size, line, n);
+            ++tail_;
+        }
+
+        if (size)
+        {
+            dma_channel_transfer_from_buffer_now(dmaCh_, txBuffer_, size);
+        }
+    }
+
+    void flush()
+    {
+        if (dmaCh_ < 0)
+        {
+            return;
+        }
+        while (tail_ != head_ || dma_channel_is_busy(dmaCh_))
+        {
+            update();
+        }
+        // FIFO に残った分
+        uart_tx_wait_blocking(uart_default);
+    }
+
+    uint32_t getDropped()
+    {
+        return dropped_;
+    }
+
+    void push(const char *fmt, const uintptr_t *args, int n)
+    {
+        Entry e{};
+        e.fmt = fmt;
+        memcpy(e.args, args, sizeof(uintptr_t) * n);
+        e.n = n;
+        pushEntry(e);
+    }
+
+    void pushBytes(const void *p, size_t size)
+    {
+        Entry e{};
+        e.fmt = nullptr;
+        e.n = std::min(size, sizeof(e.args));
+        memcpy(e.args, p, e.n);
+        pushEntry(e);
+    }
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 19:02:31
+ */
+#pragma once
+
+// UART へのログを後回しにする
+// 呼んだときは書式と引数をリングに積むだけで, 整形と DMA での送信は main loop の空き時間に行う
+// 書式は文字列リテラル, %s の引数は消えない文字列であること
+// 引数は整数かポインタだけ (ARM では 32bit 以下)
+
+#include <stdint.h>
+#include <stddef.h>
+#include <type_traits>
+
+namespace logger
+{
+    inline constexpr int N_ENTRIES = 256;
+    inline constexpr int MAX_ARGS = 6;
+
+    // DMA を用意する. stdio_init_all() の後で呼ぶ
+    void init();
+    // 溜まっている分を整形して送る. 送信中なら何もしない
+    void update();
+    // 全部送り終わるまで待つ. printf で直接出す前に呼ぶ
+    void flush();
+
+    // 満杯で捨てた数
+    uint32_t getDropped();
+
+    void push(const char *fmt, const uintptr_t *args, int n);
+    // size(<= sizeof(uintptr_t) * MAX_ARGS) バイトを16進で1行に出す
+    void pushBytes(const void *p, size_t size);
+
+    template <class T>
+    inline uintptr_t toArg(T v)
+    {
+        if constexpr (std::is_pointer_v<T>)
+        {
+            return reinterpret_cast<uintptr_t>(v);
+        }
+        else if constexpr (std::is_enum_v<T>)
+        {
+            return toArg(static_cast<std::underlying_type_t<T>>(v));
+        }
+        else
+        {
+            static_assert(std::is_integral_v<T> && sizeof(T) <= sizeof(uintptr_t),
+                          "logger: unsupported argument type");
+            // 符号付きは int にそろえてから広げる
+            if constexpr (std::is_signed_v<T>)
+            {
+                return static_cast<uintptr_t>(static_cast<intptr_t>(v));
+            }
+            else
+            {
+                return static_cast<uintptr_t>(v);
+            }
+        }
+    }
+
+    template <class... Args>
+    inline void print(const char *fmt, Args... args)
+    {
+        static_assert(sizeof...(Args) <= MAX_ARGS, "logger: too many arguments");
+        const uintptr_t a[] = {toArg(args)..., 0};
+        push(fmt, a, sizeof...(Args));
+    }
+}
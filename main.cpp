@@ -7,10 +7,12 @@
 #include <hardware/dma.h>
 #include <hardware/pwm.h>
 #include <hardware/structs/ioqspi.h>
+#include <hardware/structs/timer.h>
 #include <hardware/divider.h>
 #include <stdint.h>
 #include <tusb.h>
 #include <algorithm>
+#include <cstring>
 #include "pad_manager.h"
 #include "pad_state.h"
 #include "led.h"
@@ -26,6 +28,14 @@
 #include "pca9555.h"
 #include "i2c_manager.h"
 #include "debug.h"
+#include "vsync_detector.h"
+#include "hsync_detector.h"
+#include "dac_table.h"
+#include "pwm_dac.h"
+#include "analog_filter.h"
+#include "profiler.h"
+#include "trace.h"
+#include "mem_stat.h"
 #include <cmath>
 
 #ifdef RASPBERRYPI_PICO_W
@@ -205,195 +215,73 @@ public:
     }
 };
 
-class VSyncDetector
+// ADC のサンプリング設定
+enum class ADCMode
 {
-    // int flipDelay_ = 7; // update単位
-    uint32_t counter_ = 0;
-
-    int min_ = 256;
-    int max_ = 0;
+    FPS,     // FPS 表示のみ. 割り込みを減らす
+    SYNCHRO, // synchro 連射. 時間分解能優先
+};
 
-    bool prevLv_ = false;
-    // int delay_ = 0;
+struct ADCSampling
+{
+    int clkdiv;
+    int periodNs;   // 1 サンプルの時間
+    int bufferBits; // バッファサイズ (log2). ring DMA のため 2 の冪
+    int blockSize;  // 積算ブロックのサンプル数 (どちらも 64us)
+};
 
-    int interval_ = 0;
-    int curInterval_ = 0;
+namespace
+{
+    // 48MHz / 96 = 2us, 48MHz / 384 = 8us
+    constexpr ADCSampling adcSamplings_[] = {
+        {383, 8000, 10, 8},  // 8.192ms ごと
+        {0, 2000, 9, 32},    // 1.024ms ごと
+    };
 
-    bool enableFPS_ = false;
-    uint32_t prevVClock_ = 0;
-    uint32_t curFPS100_ = 0;
-    uint32_t aveFrameClock = 0;
-    uint32_t accumVClock_ = 0;
-    int fpsUpdateCounter_ = 0;
-    int fpsStableCounter_ = 0;
+    static constexpr int ADC_BUFFER_SIZE_MAX = 1024;
+    alignas(ADC_BUFFER_SIZE_MAX) uint8_t adcBuffer_[2][ADC_BUFFER_SIZE_MAX];
 
-public:
-    uint32_t getCounter() const { return counter_; }
+    // 2ch を交互に chain して ring で書き込むので、割り込みで再設定する必要はない
+    int adcDMACh_[2] = {dma_claim_unused_channel(true), dma_claim_unused_channel(true)};
+    int adcDMADBID_ = 0;
 
-    void reset()
-    {
-        min_ = 256;
-        max_ = 0;
-        prevLv_ = false;
-        interval_ = 0;
-        curInterval_ = 0;
+    ADCMode adcMode_ = ADCMode::SYNCHRO;
+    int adcBufferSize_ = 0;
+    uint32_t adcBufferUs_ = 0;
 
-        prevVClock_ = 0;
-        curFPS100_ = 0;
-        aveFrameClock = 0;
-        accumVClock_ = 0;
-        fpsUpdateCounter_ = 0;
-        fpsStableCounter_ = 0;
-    }
+    ButtonWatcher buttonWatcher_;
+    VSyncDetector vsyncDetector_;
+    HSyncDetector hsyncDetector_;
 
-    void setEnableFPSCount(bool f) { enableFPS_ = f; }
+    // 水平同期の計測は SYNCHRO 設定のときだけ
+    volatile bool hsyncEnabled_ = false;
+    bool hsyncOverBudget_ = false;
 
-    int getFPS100() const { return curFPS100_; }
-    uint32_t getVSyncCounter() const { return counter_; }
-    int getInterval() const { return interval_; }
+    // 水平同期の処理に使ってよいサイクル数 (1 バッファ 1.024ms の 4%)
+    static constexpr uint32_t HSYNC_CYCLE_BUDGET = CPU_CLOCK / 1000 * 4 / 100;
 
-    int getMin() const { return min_; }
-    int getMax() const { return max_; }
+    util::CycleStats adcIRQCycles_;
+    util::CycleStats hsyncIRQCycles_;
+    // main loop で表示の更新にかかったサイクル数 (IRQ を含む)
+    util::CycleStats uiCycles_;
 
-    void update(const uint8_t *p, int n)
+    // time_us_64() は flash にあるので, flash 操作中でも読めるように RAM に置く
+    uint64_t __not_in_flash_func(getTimeUs64)()
     {
-        uint32_t clk = util::getSysTickCounter24();
-        int th = (max_ + min_) >> 1;
-
-        max_ -= th >> 8;
-        min_ += th >> 8;
-
-        bool pl = prevLv_;
-        bool det = false;
-
-        while (n >= 50)
-        {
-            int acc = 0;
-            for (int ct = 5; ct; --ct)
-            {
-                acc += p[0];
-                acc += p[1];
-                acc += p[2];
-                acc += p[3];
-                acc += p[4];
-                acc += p[5];
-                acc += p[6];
-                acc += p[7];
-                acc += p[8];
-                acc += p[9];
-                p += 10;
-            }
-
-            max_ = std::max(max_, acc);
-            min_ = std::min(min_, acc);
-
-            bool lv = acc > th;
-
-            det |= (pl ^ lv) & lv;
-            pl = lv;
-
-            n -= 50;
-        }
-
-        ++curInterval_;
-
-        if (det)
+        uint32_t hi = timer_hw->timerawh;
+        uint32_t lo;
+        while (true)
         {
-            interval_ = curInterval_;
-            curInterval_ = 0;
-            // delay_ = flipDelay_;
-
-            // update FPS
-            if (enableFPS_)
+            lo = timer_hw->timerawl;
+            uint32_t hi2 = timer_hw->timerawh;
+            if (hi == hi2)
             {
-                if (prevVClock_)
-                {
-                    uint32_t vclk = (prevVClock_ - clk) & 0xffffff;
-                    accumVClock_ += vclk;
-                    // 8frame 程度しか24bitカウンタが持たないので
-                    // 素直に64frame毎に処理するわけにはいかない
-
-                    if (++fpsUpdateCounter_ == 64)
-                    {
-                        vclk = accumVClock_ >> 6;
-
-                        if (aveFrameClock == 0 ||
-                            vclk < (aveFrameClock >> 1) ||
-                            (vclk >> 1) > aveFrameClock)
-                        {
-                            fpsStableCounter_ = 0;
-                            curFPS100_ = 0;
-                        }
-                        // printf("ave %d, %d\n", aveFrameClock, vclk);
-                        if (fpsStableCounter_ > 4)
-                        {
-                            // aveFrameClock = (aveFrameClock * 1023 + vclk) >> 10;
-                            aveFrameClock = (aveFrameClock * 255 + vclk) >> 8;
-                            //  2^32 / (125000000/60) = 2062
-                            curFPS100_ = 25 * CPU_CLOCK / (aveFrameClock >> 2);
-                        }
-                        else
-                        {
-                            aveFrameClock = vclk;
-                            ++fpsStableCounter_;
-                        }
-
-                        accumVClock_ = 0;
-                        fpsUpdateCounter_ = 0;
-                    }
-                }
-                prevVClock_ = clk;
+                break;
             }
+            hi = hi2;
         }
-
-        int flipDelay = interval_ * appConfig_.synchroFetchPhase * 102 >> 10;
-        if (curInterval_ == flipDelay)
-        {
-            ++counter_;
-            // PadManager::instance().setVSyncCount(counter_);
-        }
-
-        prevLv_ = pl;
-    }
-
-    std::array<char, 6> getFPSString() const
-    {
-        int fps100 = getFPS100();
-        std::array<char, 6> buf;
-        buf[5] = 0;
-        if (fps100 == 0)
-        {
-            buf = {'-', '-', '.', '-', '-', 0};
-            return buf;
-        }
-
-        auto d0 = hw_divider_divmod_u32(fps100, 10);
-        buf[4] = '0' + to_remainder_u32(d0);
-
-        auto d1 = hw_divider_divmod_u32(to_quotient_u32(d0), 10);
-        buf[3] = '0' + to_remainder_u32(d1);
-
-        buf[2] = '.';
-
-        auto d2 = hw_divider_divmod_u32(to_quotient_u32(d1), 10);
-        buf[1] = '0' + to_remainder_u32(d2);
-
-        auto d3 = hw_divider_divmod_u32(to_quotient_u32(d2), 10);
-        buf[0] = '0' + to_remainder_u32(d3);
-        return buf;
+        return (static_cast<uint64_t>(hi) << 32) | lo;
     }
-};
-
-namespace
-{
-    static constexpr int ADC_BUFFER_SIZE = 500;
-    uint8_t adcBuffer_[2][ADC_BUFFER_SIZE];
-
-    int adcDMACh_ = dma_claim_unused_channel(true);
-    int adcDMADBID_ = 0;
-
-    ButtonWatcher buttonWatcher_;
-    VSyncDetector vsyncDetector_;
 }
 
 void initADC()
@@ -411,64 +299,182 @@ void initADC()
         true   // Shift each sample to 8 bits when pushing to FIFO
     );
 
-    adc_set_clkdiv(0);
-
     sleep_ms(100);
-
-    dma_channel_config cfg = dma_channel_get_default_config(adcDMACh_);
-
-    channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
-    channel_config_set_read_increment(&cfg, false);
-    channel_config_set_write_increment(&cfg, true);
-    channel_config_set_dreq(&cfg, DREQ_ADC);
-
-    dma_channel_configure(adcDMACh_, &cfg,
-                          nullptr,         // dst
-                          &adc_hw->fifo,   // src
-                          ADC_BUFFER_SIZE, // transfer count
-                          false            // start immediately
-    );
 }
 
-void startADCTransfer(int dbid)
+void configureADC(ADCMode mode)
 {
-    dma_hw->ints0 = 1u << adcDMACh_;
-    dma_channel_set_write_addr(adcDMACh_, adcBuffer_[dbid], true);
+    const auto &sm = adcSamplings_[static_cast<int>(mode)];
+    adcMode_ = mode;
+    adcBufferSize_ = 1 << sm.bufferBits;
+    adcBufferUs_ = static_cast<uint32_t>(adcBufferSize_) * sm.periodNs / 1000;
+
+    adc_set_clkdiv(sm.clkdiv);
+
+    for (int i = 0; i < 2; ++i)
+    {
+        dma_channel_config cfg = dma_channel_get_default_config(adcDMACh_[i]);
+
+        channel_config_set_transfer_data_size(&cfg, DMA_SIZE_8);
+        channel_config_set_read_increment(&cfg, false);
+        channel_config_set_write_increment(&cfg, true);
+        channel_config_set_ring(&cfg, true /* write */, sm.bufferBits);
+        channel_config_set_chain_to(&cfg, adcDMACh_[i ^ 1]);
+        channel_config_set_dreq(&cfg, DREQ_ADC);
+
+        dma_channel_configure(adcDMACh_[i], &cfg,
+                              adcBuffer_[i],  // dst
+                              &adc_hw->fifo,  // src
+                              adcBufferSize_, // transfer count
+                              false           // start immediately
+        );
+    }
+    adcDMADBID_ = 0;
+
+    vsyncDetector_.setSampling(sm.periodNs, sm.blockSize);
+    vsyncDetector_.reset();
+    hsyncDetector_.setSamplePeriodNs(sm.periodNs);
+    hsyncDetector_.reset();
+    hsyncEnabled_ = false;
+    hsyncOverBudget_ = false;
+    adcIRQCycles_.reset();
+    hsyncIRQCycles_.reset();
 }
 
-void enableADCIRQ()
+void enableADCIRQ(bool enable)
 {
-    dma_channel_set_irq0_enabled(adcDMACh_, true);
+    for (auto ch : adcDMACh_)
+    {
+        dma_channel_set_irq0_enabled(ch, enable);
+    }
 }
 
 void __isr __not_in_flash_func(irqHandler)()
 {
-    auto *p = adcBuffer_[adcDMADBID_];
+    auto clk = util::getSysTickCounter24();
+    auto time = getTimeUs64(); // DMA 完了時刻とみなす
+
+    uint32_t ints = dma_hw->ints0 & ((1u << adcDMACh_[0]) | (1u << adcDMACh_[1]));
+    dma_hw->ints0 = ints;
 
-    adcDMADBID_ ^= 1;
-    startADCTransfer(adcDMADBID_);
+    // 割り込みが遅れて両方終わっていたら古いほうから処理する
+    int id = adcDMADBID_;
+    if (!(ints & (1u << adcDMACh_[id])))
+    {
+        id ^= 1;
+    }
+    if (ints == ((1u << adcDMACh_[0]) | (1u << adcDMACh_[1])))
+    {
+        time -= adcBufferUs_;
+    }
 
-    hw_divider_state_t divState;
-    hw_divider_save_state(&divState);
+    // 除算器は使わないので退避は不要
+    for (; ints & (1u << adcDMACh_[id]); id ^= 1)
+    {
+        ints &= ~(1u << adcDMACh_[id]);
+        vsyncDetector_.update(adcBuffer_[id], adcBufferSize_, time);
+        time += adcBufferUs_;
 
-    vsyncDetector_.update(p, ADC_BUFFER_SIZE);
+        if (hsyncEnabled_)
+        {
+            auto hclk = util::getSysTickCounter24();
+            hsyncDetector_.update(adcBuffer_[id], adcBufferSize_,
+                                  vsyncDetector_.getSampleThreshold());
+            hsyncIRQCycles_.add((hclk - util::getSysTickCounter24()) & 0xffffff);
+        }
+    }
+    adcDMADBID_ = id;
 
-    hw_divider_restore_state(&divState);
+    adcIRQCycles_.add((clk - util::getSysTickCounter24()) & 0xffffff);
 }
 
-void startADC()
+void startADC(ADCMode mode)
 {
-    enableADCIRQ();
+    configureADC(mode);
+    enableADCIRQ(true);
 
     irq_set_exclusive_handler(DMA_IRQ_0, irqHandler);
     irq_set_enabled(DMA_IRQ_0, true);
 
-    startADCTransfer(0);
+    // ハンドラは全て RAM にあるので設定の保存中も止めない
+    // ハンドラから呼ぶ関数は __not_in_flash_func か __force_inline にすること
+    // ただの inline 関数や std::max などは -Og や PICO_DEOPTIMIZED_DEBUG で flash 上に実体が作られ,
+    // 保存中に呼ぶと止まる
+    setFlashSafeIRQMask(1u << DMA_IRQ_0);
+
+    dma_channel_start(adcDMACh_[0]);
 
     adc_run(true);
 }
 
+void stopADC()
+{
+    adc_run(false);
+
+    // abort 時に割り込みが上がることがあるので先に止める
+    enableADCIRQ(false);
+    for (auto ch : adcDMACh_)
+    {
+        dma_channel_abort(ch);
+    }
+    dma_hw->ints0 = (1u << adcDMACh_[0]) | (1u << adcDMACh_[1]);
+
+    adc_fifo_drain();
+}
+
+ADCMode getRequiredADCMode()
+{
+    // 水平同期を見るときも 2us サンプリングが必要
+    return appConfig_.rapidModeSynchro || appConfig_.dispFPS == 2 ? ADCMode::SYNCHRO : ADCMode::FPS;
+}
+
+void updateADCMode()
+{
+    auto mode = getRequiredADCMode();
+    if (mode != adcMode_)
+    {
+        stopADC();
+        startADC(mode);
+    }
+}
+
+void updateHSyncDetector()
+{
+    bool enable = appConfig_.dispFPS == 2 && adcMode_ == ADCMode::SYNCHRO;
+    if (enable && !hsyncOverBudget_ && hsyncIRQCycles_.count >= 16 &&
+        hsyncIRQCycles_.getAve() > HSYNC_CYCLE_BUDGET)
+    {
+        // 予算を超えたら止める. 設定を変えるまでそのまま
+        DPRINT(("hsync over budget: %d cycles\n", (int)hsyncIRQCycles_.getAve()));
+        hsyncOverBudget_ = true;
+        hsyncDetector_.reset();
+    }
+    enable &= !hsyncOverBudget_;
+
+    if (enable != hsyncEnabled_)
+    {
+        if (enable)
+        {
+            hsyncDetector_.reset();
+        }
+        hsyncEnabled_ = enable;
+    }
+
+    if (enable)
+    {
+        hsyncDetector_.updateMeasure(vsyncDetector_.isLocked() ? vsyncDetector_.getFramePeriodQ8() : 0);
+    }
+}
+
+// ADC 割り込みの CPU 負荷 (1/10000)
+int getADCIRQLoad()
+{
+    uint64_t cycles = adcIRQCycles_.getAve();
+    return cycles * 10000 * 1000000 / (uint64_t(CPU_CLOCK) * adcBufferUs_);
+}
+
 void updateMIDIState();
+void invalidateStatusDisplay();
 
 // void setLCDContrast()
 // {
@@ -506,10 +512,106 @@ void setRapidSettings()
     }
 }
 
+namespace
+{
+    // ロータリーエンコーダ出力
+    // Port1,2 のピンはタイマー IRQ から直接書く
+    struct RotEncPins
+    {
+        int a = -1;
+        int b = -1;
+    };
+    RotEncPins rotEncPins_[2][2]; // [port][kind]
+    uint32_t rotEncGPIOMask_ = 0; // updateJAMMAOutput で書かないピン
+
+    repeating_timer_t rotEncTimer_;
+    bool rotEncTimerRunning_ = false;
+    bool rotEncOutputEnabled_ = false; // 電源 ON の間だけ出力する
+
+    int findButtonGPIO(int port, PadStateButton b)
+    {
+        for (auto &m : padPortMap_[port])
+        {
+            if (m.padState == b)
+            {
+                return static_cast<int>(m.gpio);
+            }
+        }
+        return -1;
+    }
+
+    bool __not_in_flash_func(rotEncTimerCallback)(repeating_timer_t *)
+    {
+        auto &padManager = PadManager::instance();
+        for (int port = 0; port < PadManager::N_OUTPUT_PORTS; ++port)
+        {
+            for (int kind = 0; kind < 2; ++kind)
+            {
+                auto &re = padManager.getRotEncoder(port, kind);
+                if (!re)
+                {
+                    continue;
+                }
+                re.tick();
+
+                if (port < 2)
+                {
+                    auto &pins = rotEncPins_[port][kind];
+                    auto [a, b] = re.getEncState();
+                    gpio_put(pins.a, a != REVERSE_STATE);
+                    gpio_put(pins.b, b != REVERSE_STATE);
+                }
+            }
+        }
+        return true;
+    }
+
+    void updateRotEncOutput()
+    {
+        static constexpr PadStateButton pinButtons[2][2] = {
+            {PadStateButton::LEFT, PadStateButton::RIGHT},
+            {PadStateButton::UP, PadStateButton::DOWN},
+        };
+
+        bool run = false;
+        uint32_t mask = 0;
+        for (int kind = 0; kind < 2; ++kind)
+        {
+            bool enabled = rotEncOutputEnabled_ && appConfig_.rotEnc[kind].axis != 0;
+            run |= enabled;
+            for (int port = 0; port < 2; ++port)
+            {
+                auto &pins = rotEncPins_[port][kind];
+                pins.a = findButtonGPIO(port, pinButtons[kind][0]);
+                pins.b = findButtonGPIO(port, pinButtons[kind][1]);
+                if (enabled)
+                {
+                    mask |= (1u << pins.a) | (1u << pins.b);
+                }
+            }
+        }
+
+        if (run && !rotEncTimerRunning_)
+        {
+            // 負の周期は前回の開始時刻からの間隔になる
+            rotEncTimerRunning_ = add_repeating_timer_us(-1000000 / RotEncoder::TICK_HZ,
+                                                         rotEncTimerCallback, nullptr, &rotEncTimer_);
+        }
+        else if (!run && rotEncTimerRunning_)
+        {
+            cancel_repeating_timer(&rotEncTimer_);
+            rotEncTimerRunning_ = false;
+        }
+        rotEncGPIOMask_ = run ? mask : 0;
+    }
+}
+
 void setRotEncSettings(int kind)
 {
     const auto &re = appConfig_.rotEnc[kind];
-    PadManager::instance().setRotEncSetting(kind, re.axis - 1, re.scale * (re.reverse ? -1 : 1));
+    PadManager::instance().setRotEncSetting(kind, re.axis - 1, re.scale * (re.reverse ? -1 : 1),
+                                            static_cast<RotEncoder::Mode>(re.mode));
+    updateRotEncOutput();
 }
 
 void saveRapidSettings()
@@ -564,47 +666,27 @@ void initButtonGPIO()
 
 namespace
 {
-    uint16_t dacTable_[1025];
-    int16_t dacSensCurve_[AppConfig::ANALOG_MAX][1025];
+    // E1, E2, F1, F2 の順
+    // フィルタはレポートが来たときだけ進め, 間は最後の出力を保つ
+    AnalogFilter analogFilters_[4];
+    uint64_t analogFilterTime_[4]{};
+    uint32_t analogFilterReport_[4]{}; // 最後に使ったレポートの PadManager::getReportCount()
+    int analogFilterValue_[4]{};
+
+    // 変化したときしかレポートを送らない機器でも収束するように,
+    // レポートがこれだけ来なければ同じ値でフィルタを進める
+    constexpr uint64_t ANALOG_FILTER_HOLD_US = 8000;
 
     int analogTestValue_ = -1;
     int analogTestMode_ = 0;
-}
 
-void initDACTable()
-{
-    for (int i = 0; i < 1025; ++i)
-    {
-        float v = i * 5.0 / 1024;
-        float y = (1.422f * v * v * v - 9.613f * v * v - 33.06f * v + 233.496f) / 256.0f;
-
-        dacTable_[i] = std::clamp(int(y * 1023 + 0.5f), 0, 1023);
-    }
-}
-
-void initDACSensCurve(int axis)
-{
-    float sensitivity = appConfig_.analogSettings[axis].sensitivity;
-    if (sensitivity == 0)
-    {
-        for (int i = 0; i < 1025; ++i)
-        {
-            dacSensCurve_[axis][i] = i * 2 - 1024;
-        }
-    }
-    else
-    {
-        float d = 1.0f / (1.0f - exp(-sensitivity));
-
-        for (int i = 0; i < 1025; ++i)
-        {
-            float v = (i - 512) / 512.0f;
-            float av = fabsf(v);
-            float sign = v < 0 ? -1 : 1;
-            float y = sign * (1.0f - expf(-sensitivity * av)) * d;
-            dacSensCurve_[axis][i] = std::clamp(int(y * 1024), -1024, 1024);
-        }
-    }
+    int cycleStatsView_ = 0;
+#ifdef ENABLE_PROFILER
+    int profileView_ = 0;
+#endif
+#ifdef ENABLE_MEMSTAT
+    int memStatView_ = 0;
+#endif
 }
 
 int applyDACSensCurve(int axis, int v, int ofs, int scale_10, bool hasCenter)
@@ -614,23 +696,15 @@ int applyDACSensCurve(int axis, int v, int ofs, int scale_10, bool hasCenter)
     int r = 0;
     if (hasCenter)
     {
-        r = dacSensCurve_[axis][v] * scale_10 / 20 + 512;
+        r = getDACSensCurve(appConfig_.analogSettings[axis].sensitivity, v) * scale_10 / 20 + 512;
     }
     else
     {
-        r = dacSensCurve_[axis][(v >> 1) + 512] * scale_10 / 10;
+        r = getDACSensCurve(appConfig_.analogSettings[axis].sensitivity, (v >> 1) + 512) * scale_10 / 10;
     }
     return std::clamp(r, 0, 1024);
 }
 
-void initDACSensCurves()
-{
-    for (int i = 0; i < AppConfig::ANALOG_MAX; ++i)
-    {
-        initDACSensCurve(i);
-    }
-}
-
 void initDACPWM()
 {
     // E,F 出力を PWM による DAC 出力にするための基本設定
@@ -657,21 +731,21 @@ void initDACPWM()
 void setDACValue(ButtonGPIO gpio, int v)
 {
     auto pin = static_cast<int>(gpio);
-    auto vv = dacTable_[v];
+    auto vv = getDACLevel(v);
 #ifndef NDEBUG
     if (analogTestValue_ >= 0)
     {
         if (analogTestMode_ == 0)
         {
-            vv = dacTable_[analogTestValue_ * 4];
+            vv = getDACLevel(analogTestValue_ * 4);
         }
         else
         {
-            vv = std::clamp(analogTestValue_ * 4, 0, 1023);
+            vv = std::clamp(analogTestValue_ * 4, 0, 1023) << PWMDAC::DITHER_BITS;
         }
     }
 #endif
-    pwm_set_gpio_level(pin, vv);
+    getPWMDAC().setLevel(pin, vv);
     // printf("(%d:%d:%d)\n", pin, v, vv);
 }
 
@@ -687,6 +761,25 @@ void setAnalogValue(const PadState::AnalogState &st, int port)
                                  hasCenter);
     };
 
+    auto now = time_us_64();
+    auto report = PadManager::instance().getReportCount(port);
+    auto output = [&](ButtonGPIO gpio, int i)
+    {
+        int ch = static_cast<int>(gpio) - static_cast<int>(ButtonGPIO::E1);
+        // main loop は同じサンプルで何度も来る. 小さな dt で進めると係数が 0 に丸められて止まる
+        if (report != analogFilterReport_[ch] ||
+            now - analogFilterTime_[ch] >= ANALOG_FILTER_HOLD_US)
+        {
+            auto &f = analogFilters_[ch];
+            f.setLevel(appConfig_.analogSettings[i].smoothing);
+            uint32_t dt = std::min<uint64_t>(now - analogFilterTime_[ch], UINT32_MAX);
+            analogFilterTime_[ch] = now;
+            analogFilterReport_[ch] = report;
+            analogFilterValue_[ch] = f.update(getValue(i), dt);
+        }
+        setDACValue(gpio, analogFilterValue_[ch]);
+    };
+
     switch (appConfig_.getAnalogMode())
     {
     default:
@@ -696,23 +789,23 @@ void setAnalogValue(const PadState::AnalogState &st, int port)
     case AppConfig::AnalogMode::_1P2P_EACH_2CH:
         if (port == 0)
         {
-            setDACValue(ButtonGPIO::E1, getValue(0));
-            setDACValue(ButtonGPIO::F1, getValue(1));
+            output(ButtonGPIO::E1, 0);
+            output(ButtonGPIO::F1, 1);
         }
         else
         {
-            setDACValue(ButtonGPIO::E2, getValue(0));
-            setDACValue(ButtonGPIO::F2, getValue(1));
+            output(ButtonGPIO::E2, 0);
+            output(ButtonGPIO::F2, 1);
         }
         break;
 
     case AppConfig::AnalogMode::_1P_ONLY_4CH:
         if (port == 0)
         {
-            setDACValue(ButtonGPIO::E1, getValue(0));
-            setDACValue(ButtonGPIO::E2, getValue(1));
-            setDACValue(ButtonGPIO::F1, getValue(2));
-            setDACValue(ButtonGPIO::F2, getValue(3));
+            output(ButtonGPIO::E1, 0);
+            output(ButtonGPIO::E2, 1);
+            output(ButtonGPIO::F1, 2);
+            output(ButtonGPIO::F2, 3);
         }
         break;
     }
@@ -723,10 +816,18 @@ void setupGPIO()
     if (appConfig_.getAnalogMode() != AppConfig::AnalogMode::NONE)
     {
         initDACPWM();
-        initDACTable();
+
+        static constexpr int dacPins[] = {
+            static_cast<int>(ButtonGPIO::E1),
+            static_cast<int>(ButtonGPIO::E2),
+            static_cast<int>(ButtonGPIO::F1),
+            static_cast<int>(ButtonGPIO::F2),
+        };
+        getPWMDAC().start(dacPins, std::size(dacPins));
     }
     else
     {
+        getPWMDAC().stop();
         initButtonGPIO();
     }
 }
@@ -740,7 +841,6 @@ void applySettings()
     setTwinPortSetting();
     setAnalogMode();
     setupGPIO();
-    initDACSensCurves();
 }
 
 void resetConfigs()
@@ -753,6 +853,7 @@ void resetConfigs()
 
 void load()
 {
+    MEMSTAT_SCOPE(SERIALIZER);
     Deserializer s;
     if (!s)
     {
@@ -763,6 +864,7 @@ void load()
     if (!appConfig_.deserialize(s))
     {
         DPRINT(("AppConfig load failed\n"));
+        appConfig_ = AppConfig();
         return;
     }
 
@@ -774,15 +876,87 @@ void load()
     DPRINT(("Loaded.\n"));
 }
 
+namespace
+{
+    bool savePending_ = false;
+    uint64_t saveStartTime_ = 0;
+    int saveVerifyFailures_ = 0;
+
+    // 読み返しが合わないときに書きなおす回数
+    // 壊れたセクタだと何度書いても同じなので, 消去を繰り返さないように諦める
+    constexpr int MAX_SAVE_VERIFY_RETRIES = 2;
+
+    // セクタ消去はボタンが離されるまで待つ. ただしこれ以上は待たない
+    constexpr uint64_t ERASE_DEFER_US = 2000000;
+}
+
+// 保存の予約. 実際には main loop の updateSave() で書く
 void save()
 {
-    Serializer s(65536, 512);
+    savePending_ = true;
+    saveVerifyFailures_ = 0;
+}
 
-    appConfig_.serialize(s);
-    PadManager::instance().serialize(s);
+// 保存を進める. flash 操作は1回に1つだけ
+void updateSave(uint64_t now)
+{
+    if (savePending_ && !isConfigFlashBusy())
+    {
+        savePending_ = false;
+        saveStartTime_ = now;
 
-    s.flash();
-    DPRINT(("Saved.\n"));
+        auto generate = [](Serializer &s)
+        {
+            appConfig_.serialize(s);
+            PadManager::instance().serialize(s);
+        };
+        if (beginConfigFlash(generate, 512))
+        {
+            DPRINT(("Saving.\n"));
+        }
+    }
+
+    if (isConfigFlashBusy())
+    {
+        // 消去中は USB などの IRQ が長く止まるので, 操作していないときに行う
+        auto &padManager = PadManager::instance();
+        bool idle = true;
+        for (int port = 0; port < PadManager::N_OUTPUT_PORTS; ++port)
+        {
+            idle &= !padManager.getNonRapidButtons(port);
+        }
+        if (!stepConfigFlash(idle || now - saveStartTime_ > ERASE_DEFER_US))
+        {
+            if (isConfigFlashAborted())
+            {
+                // 書いている間に設定が変わった
+                savePending_ = true;
+            }
+            else if (isConfigFlashVerifyFailed())
+            {
+                if (saveVerifyFailures_++ < MAX_SAVE_VERIFY_RETRIES)
+                {
+                    savePending_ = true;
+                }
+                else
+                {
+                    DPRINT(("Save failed.\n"));
+                }
+            }
+            else
+            {
+                saveVerifyFailures_ = 0;
+                // 保存前の内容を参照しているので保存した方に付け替える
+                // DELTA で保存したときは前の内容と overlay をそのまま使い続ける
+                size_t size;
+                if (auto *image = getStoredConfigImage(size))
+                {
+                    PadManager::instance().onConfigStored(image, size);
+                }
+                DPRINT(("Saved.\n"));
+            }
+        }
+    }
 }
 
 char getButtonName(PadStateButton b)
@@ -909,191 +1083,333 @@ const char *getButtonConfigText(PadStateButton b)
     return appConfig_.twinPortMode ? getButtonConfigText2PortMode(b) : getButtonConfigTextNormal(b);
 }
 
-void initMenu()
+namespace
 {
-    static const char *buttonDispModeText[] = {"Input", "Rapid", "None"};
-    static const char *onOffText[] = {"Off", "On"};
-    static const char *inOutText[] = {"In", "Out"};
-    static const char *reverseText[] = {"Normal", "Reverse"};
-    static const char *initPowerModeText[] = {"InitOff", "InitOn"};
-    static const char *rapidModeText[] = {"Softw", "Synchro"};
-    static const char *analogModeText[] = {"Disable", "2Axis2P", "4Axis1P"};
+    constexpr const char *buttonDispModeText[] = {"Input", "Rapid", "None"};
+    constexpr const char *onOffText[] = {"Off", "On"};
+    constexpr const char *dispFPSText[] = {"Off", "On", "On+Sync"};
+    constexpr const char *inOutText[] = {"In", "Out"};
+    constexpr const char *reverseText[] = {"Normal", "Reverse"};
+    constexpr const char *initPowerModeText[] = {"InitOff", "InitOn"};
+    constexpr const char *rapidModeText[] = {"Softw", "Synchro"};
+    constexpr const char *analogModeText[] = {"Disable", "2Axis2P", "4Axis1P"};
+    constexpr const char *rotEncAxisText[] = {"None", "Axis X", "Axis Y", "Axis Z", "Axis RX", "Axis RY", "Axis RZ", "SLIDER", "DIAL", "WHEEL"};
+    constexpr const char *rotEncModeText[] = {"Speed", "Pos", "Pos360"};
+#ifndef NDEBUG
+    constexpr const char *analogTestModeText[] = {"Convert", "Direct"};
+#endif
 
-    menu_.setBlinkInterval(CPU_CLOCK / 2);
+    bool isAnalogEnabled(int)
+    {
+        return appConfig_.getAnalogMode() != AppConfig::AnalogMode::NONE;
+    }
 
-    PadManager::instance().setOnExitConfigFunc(
-        []
-        {
-            DPRINT(("exit button config\n"));
-            textScreen_.clearAll();
-            menu_.forceClose();
-            menu_.refresh();
-        });
+    // ctx はアナログのチャンネル
+    bool isAnalogChannelEnabled(int ch)
+    {
+        return ch < appConfig_.getAnalogModeChannels();
+    }
 
-    menu_.append(
-        "BtnCfg", "LngPress", [](Menu &m)
-        { 
-            textScreen_.clearAll();
-            textScreen_.printMain(0, 0, "BtConfig");
-            PadManager::instance().enterConfigMode(); },
-        true /* config button */);
-    menu_.append(
-             "AnlgCfg", "LngPress", [](Menu &m)
-             { 
-            textScreen_.clearAll();
-            textScreen_.printMain(0, 0, "AnalgCfg");
-            PadManager::instance().enterAnalogConfigMode(); },
-             true /* config button */)
-        .setConditionFunc(
-            []()
-            {
-                return appConfig_.getAnalogMode() != AppConfig::AnalogMode::NONE;
-            });
-    menu_.append("AnalgMd", &appConfig_.analogMode, analogModeText, std::size(analogModeText),
-                 [&](Menu &m)
-                 {
-                     setAnalogMode();
-                     setupGPIO();
-                 });
-#ifndef NDEBUG
-    menu_.append("AnlgTst", &analogTestValue_, {-1, 256},
-                 [](char *buf, size_t bufSize, int v)
-                 {
-                     if (analogTestValue_ >= 0)
-                     {
-                         snprintf(buf, bufSize, "%3d", analogTestValue_);
-                     }
-                     else
-                     {
-                         snprintf(buf, bufSize, "Disable");
-                     }
-                 })
-        .setConditionFunc(
-            []()
-            { return appConfig_.getAnalogMode() != AppConfig::AnalogMode::NONE; });
-
-    static const char *analogTestModeText[] = {"Convert", "Direct"};
-    menu_.append("AnlgTst", &analogTestMode_, analogTestModeText, std::size(analogTestModeText));
-#endif
-    for (int i = 0; i < AppConfig::ANALOG_MAX; ++i)
+    void formatAnalogChannelValue(char *buf, size_t bufSize, int v, int ch)
     {
-        auto condFunc = [=]()
-        {
-            return i < appConfig_.getAnalogModeChannels();
-        };
+        snprintf(buf, bufSize, "[%d]:%d", ch + 1, v);
+    }
 
-        menu_.append("AnlgSns", &appConfig_.analogSettings[i].sensitivity, {-16, 16}, [=](char *buf, size_t bufSize, int v)
-                     { snprintf(buf, bufSize, "[%d]:%d", i + 1, v); }, [=](Menu &m)
-                     { initDACSensCurve(i); })
-            .setConditionFunc(condFunc);
-        menu_.append("AnlgOfs", &appConfig_.analogSettings[i].offset, {-99, 99}, [=](char *buf, size_t bufSize, int v)
-                     { snprintf(buf, bufSize, "[%d]:%d", i + 1, v); })
-            .setConditionFunc(condFunc);
-        menu_.append("AnlgMag", &appConfig_.analogSettings[i].scale, {1, 99}, [=](char *buf, size_t bufSize, int v)
-                     { snprintf(buf, bufSize, "[%d]:%d.%d", i + 1, v / 10, v % 10); })
-            .setConditionFunc(condFunc);
-    }
-
-    menu_.append("PowMode", &appConfig_.initPowerOn,
-                 initPowerModeText, std::size(initPowerModeText));
-    menu_.append("DispFPS", &appConfig_.dispFPS, onOffText, 2);
-    menu_.append("BtnDisp", &appConfig_.buttonDispMode,
-                 buttonDispModeText, std::size(buttonDispModeText));
-    menu_.append("BackLit", &appConfig_.backLight, onOffText, 2);
-    // menu_.append("LCD Ctr", &appConfig_.LCDContrast, {0, 15}, [](char *buf, size_t bufSize, int v)
-    //              { snprintf(buf, bufSize, "%2d", v); }, [](Menu &)
-    //              { setLCDContrast(); });
-    menu_.append("RapidMd", &appConfig_.rapidModeSynchro, rapidModeText, std::size(rapidModeText));
-    menu_.append("SwRapid", &appConfig_.softwareRapidSpeed, {1, 30},
-                 // "%2dShot\3"
-                 [](char *buf, size_t bufSize, int v)
-                 { snprintf(buf, bufSize, "%2dShot\3", v); })
-        .setConditionFunc(
-            []()
-            { return !appConfig_.rapidModeSynchro; });
-    menu_.append("SyncUpT", &appConfig_.synchroFetchPhase, {0, 9},
-                 [](char *buf, size_t bufSize, int v)
-                 { snprintf(buf, bufSize, "%2d%%", v * 10); })
-        .setConditionFunc([]()
-                          { return appConfig_.rapidModeSynchro; });
-
-    auto onRapidPhaseChanged = [](Menu &m)
+    // ctx はロータリーエンコーダの番号
+    bool isRotEncEnabled(int kind)
+    {
+        return appConfig_.rotEnc[kind].axis != 0;
+    }
+
+    void onRotEncChanged(Menu &, int kind)
+    {
+        setRotEncSettings(kind);
+    }
+
+    void onRapidPhaseChanged(Menu &, int)
     {
         setRapidPhaseMask();
-    };
+    }
 
-    menu_.append("Phase A", &appConfig_.rapidPhase[0], inOutText, 2, onRapidPhaseChanged);
-    menu_.append("Phase B", &appConfig_.rapidPhase[1], inOutText, 2, onRapidPhaseChanged);
-    menu_.append("Phase C", &appConfig_.rapidPhase[2], inOutText, 2, onRapidPhaseChanged);
-    menu_.append("Phase D", &appConfig_.rapidPhase[3], inOutText, 2, onRapidPhaseChanged);
-    menu_.append("Phase E", &appConfig_.rapidPhase[4], inOutText, 2, onRapidPhaseChanged);
-    menu_.append("Phase F", &appConfig_.rapidPhase[5], inOutText, 2, onRapidPhaseChanged);
+#define MAKE_ANALOG_SETTING_ITEMS(i)                                                                          \
+    Menu::Item::number("AnlgSns", &appConfig_.analogSettings[i].sensitivity,                                  \
+                       {DAC_SENSITIVITY_MIN, DAC_SENSITIVITY_MAX}, formatAnalogChannelValue)                   \
+        .setConditionFunc(isAnalogChannelEnabled)                                                             \
+        .setContext(i),                                                                                       \
+        Menu::Item::number("AnlgOfs", &appConfig_.analogSettings[i].offset, {-99, 99},                        \
+                           formatAnalogChannelValue)                                                          \
+            .setConditionFunc(isAnalogChannelEnabled)                                                         \
+            .setContext(i),                                                                                   \
+        Menu::Item::number("AnlgMag", &appConfig_.analogSettings[i].scale, {1, 99},                           \
+                           [](char *buf, size_t bufSize, int v, int ch)                                       \
+                           { snprintf(buf, bufSize, "[%d]:%d.%d", ch + 1, v / 10, v % 10); })                 \
+            .setConditionFunc(isAnalogChannelEnabled)                                                         \
+            .setContext(i),                                                                                   \
+        /* 平滑化. 大きいほど静止時のジッタが減るが遅延が増える */                                            \
+        Menu::Item::number("AnlgFlt", &appConfig_.analogSettings[i].smoothing, {0, AnalogFilter::LEVEL_MAX},  \
+                           formatAnalogChannelValue)                                                          \
+            .setConditionFunc(isAnalogChannelEnabled)                                                         \
+            .setContext(i)
+
+    // メニュー項目. 起動時に作らずに flash に置いたまま使う
+    constexpr Menu::Item menuItems_[] = {
+        Menu::Item::action(
+            "BtnCfg", "LngPress", [](Menu &m, int)
+            {
+                textScreen_.clearAll();
+                textScreen_.printMain(0, 0, "BtConfig");
+                PadManager::instance().enterConfigMode(); },
+            true /* config button */),
+        Menu::Item::action(
+            "AnlgCfg", "LngPress", [](Menu &m, int)
+            {
+                textScreen_.clearAll();
+                textScreen_.printMain(0, 0, "AnalgCfg");
+                PadManager::instance().enterAnalogConfigMode(); },
+            true /* config button */)
+            .setConditionFunc(isAnalogEnabled),
+        Menu::Item::select("AnalgMd", &appConfig_.analogMode, analogModeText,
+                           [](Menu &m, int)
+                           {
+                               setAnalogMode();
+                               setupGPIO();
+                           }),
+#ifndef NDEBUG
+        Menu::Item::number("AnlgTst", &analogTestValue_, {-1, 256},
+                           [](char *buf, size_t bufSize, int v, int)
+                           {
+                               if (analogTestValue_ >= 0)
+                               {
+                                   snprintf(buf, bufSize, "%3d", analogTestValue_);
+                               }
+                               else
+                               {
+                                   snprintf(buf, bufSize, "Disable");
+                               }
+                           })
+            .setConditionFunc(isAnalogEnabled),
+        Menu::Item::select("AnlgTst", &analogTestMode_, analogTestModeText),
+
+        // ADC(VSync) IRQ の処理サイクル数と CPU 負荷. A でリセット
+        Menu::Item::number(
+            "IRQ Cyc", &cycleStatsView_, {0, 6},
+            [](char *buf, size_t bufSize, int v, int)
+            {
+                const auto &s = adcIRQCycles_;
+                switch (v)
+                {
+                default:
+                    snprintf(buf, bufSize, "ave%5d", (int)s.getAve());
+                    break;
+                case 1:
+                    snprintf(buf, bufSize, "min%5d", (int)s.getMin());
+                    break;
+                case 2:
+                    snprintf(buf, bufSize, "max%5d", (int)s.getMax());
+                    break;
+                case 3:
+                {
+                    int load = getADCIRQLoad();
+                    snprintf(buf, bufSize, "%c%3d.%02d%%",
+                             adcMode_ == ADCMode::SYNCHRO ? 'S' : 'F', load / 100, load % 100);
+                }
+                break;
+                case 4:
+                    // 水平同期の計測分
+                    snprintf(buf, bufSize, "H%c%6d", hsyncOverBudget_ ? '!' : ' ',
+                             (int)hsyncIRQCycles_.getAve());
+                    break;
+                case 5:
+                    // 設定の保存で IRQ を止めた最大時間 (us)
+                    snprintf(buf, bufSize, "F%7d", (int)getFlashIRQOffStats().getMax());
+                    break;
+                case 6:
+                    // main loop の表示更新
+                    snprintf(buf, bufSize, "U%7d", (int)uiCycles_.getAve());
+                    break;
+                }
+            },
+            {},
+            [](Menu &m, int)
+            {
+                adcIRQCycles_.reset();
+                hsyncIRQCycles_.reset();
+                uiCycles_.reset();
+                getFlashIRQOffStats().reset();
+            }),
+#endif
+#ifdef ENABLE_PROFILER
+        // main loop の段ごとの平均 (a) と最大 (x) のサイクル数. A で UART に全部出す
+        Menu::Item::number(
+            "Profile", &profileView_, {0, profiler::N_STAGE * 2 - 1},
+            [](char *buf, size_t bufSize, int v, int)
+            {
+                auto stage = static_cast<profiler::Stage>(v >> 1);
+                const auto &s = profiler::getStats(stage);
+                if ((v & 1) && s.overflows)
+                {
+                    // 2^24 サイクルを越えた回があるので最大値は測れていない
+                    snprintf(buf, bufSize, "%.2sx over", profiler::getStageName(stage));
+                    return;
+                }
+                unsigned c = v & 1 ? s.getMax() : s.getAve();
+                const char *fmt = c < 100000 ? "%.2s%c%5u" : "%.2s%c%4uk";
+                snprintf(buf, bufSize, fmt, profiler::getStageName(stage),
+                         v & 1 ? 'x' : 'a', c < 100000 ? c : c / 1000);
+            },
+            {},
+            [](Menu &m, int)
+            { profiler::dump(); }),
+#endif
+#ifdef ENABLE_MEMSTAT
+        // ヒープの使用量, ピーク, 残り, スタックの使用量, 部分ごとの確保回数,
+        // 定常状態で入力の経路が確保した回数. A で UART に出す
+        Menu::Item::number(
+            "Memory", &memStatView_, {0, 5 + memstat::N_TAGS},
+            [](char *buf, size_t bufSize, int v, int)
+            {
+                switch (v)
+                {
+                case 0:
+                    snprintf(buf, bufSize, "U%7u", (unsigned)memstat::getHeapUsed());
+                    break;
+                case 1:
+                    snprintf(buf, bufSize, "P%7u", (unsigned)memstat::getHeapPeak());
+                    break;
+                case 2:
+                    snprintf(buf, bufSize, "F%7u", (unsigned)memstat::getHeapFree());
+                    break;
+                case 3:
+                case 4:
+                    snprintf(buf, bufSize, "S%d%6u", v - 3, (unsigned)memstat::getStackStats(v - 3).used);
+                    break;
+                case 5 + memstat::N_TAGS:
+                    snprintf(buf, bufSize, "!%7u", (unsigned)memstat::getSteadyAllocCount());
+                    break;
+                default:
+                {
+                    auto tag = static_cast<memstat::Tag>(v - 5);
+                    snprintf(buf, bufSize, "%.2s%6u", memstat::getTagName(tag),
+                             (unsigned)memstat::getTagStats(tag).count);
+                }
+                break;
+                }
+            },
+            {},
+            [](Menu &m, int)
+            { memstat::dump(); }),
+#endif
+        MAKE_ANALOG_SETTING_ITEMS(0),
+        MAKE_ANALOG_SETTING_ITEMS(1),
+        MAKE_ANALOG_SETTING_ITEMS(2),
+        MAKE_ANALOG_SETTING_ITEMS(3),
+
+        Menu::Item::select("PowMode", &appConfig_.initPowerOn, initPowerModeText),
+        Menu::Item::select("DispFPS", &appConfig_.dispFPS, dispFPSText),
+        Menu::Item::select("BtnDisp", &appConfig_.buttonDispMode, buttonDispModeText),
+        Menu::Item::select("BackLit", &appConfig_.backLight, onOffText),
+        // Menu::Item::number("LCD Ctr", &appConfig_.LCDContrast, {0, 15}, [](char *buf, size_t bufSize, int v, int)
+        //                    { snprintf(buf, bufSize, "%2d", v); }, [](Menu &, int)
+        //                    { setLCDContrast(); }),
+        Menu::Item::select("RapidMd", &appConfig_.rapidModeSynchro, rapidModeText),
+        Menu::Item::number("SwRapid", &appConfig_.softwareRapidSpeed, {1, 30},
+                           [](char *buf, size_t bufSize, int v, int)
+                           { snprintf(buf, bufSize, "%2dShot\3", v); })
+            .setConditionFunc(
+                [](int)
+                { return !appConfig_.rapidModeSynchro; }),
+        Menu::Item::number("SyncUpT", &appConfig_.synchroFetchPhase, {0, 9},
+                           [](char *buf, size_t bufSize, int v, int)
+                           { snprintf(buf, bufSize, "%2d%%", v * 10); })
+            .setConditionFunc([](int)
+                              { return !!appConfig_.rapidModeSynchro; }),
+
+        Menu::Item::select("Phase A", &appConfig_.rapidPhase[0], inOutText, onRapidPhaseChanged),
+        Menu::Item::select("Phase B", &appConfig_.rapidPhase[1], inOutText, onRapidPhaseChanged),
+        Menu::Item::select("Phase C", &appConfig_.rapidPhase[2], inOutText, onRapidPhaseChanged),
+        Menu::Item::select("Phase D", &appConfig_.rapidPhase[3], inOutText, onRapidPhaseChanged),
+        Menu::Item::select("Phase E", &appConfig_.rapidPhase[4], inOutText, onRapidPhaseChanged),
+        Menu::Item::select("Phase F", &appConfig_.rapidPhase[5], inOutText, onRapidPhaseChanged),
+
+        Menu::Item::action(
+            "InitRpd", "Press A", [](Menu &m, int)
+            {
+                DPRINT(("reset rapid state\n"));
+                textScreen_.printInfo(0, 1, " Init'd ");
+                textScreen_.setInfoLayerClearTimer(CPU_CLOCK);
+                resetRapidSettings(); }),
 
-    menu_.append(
-        "InitRpd", "Press A", [](Menu &m)
-        {
-            DPRINT(("reset rapid state\n"));
-            textScreen_.printInfo(0, 1, " Init'd ");
-            textScreen_.setInfoLayerClearTimer(CPU_CLOCK);
-            resetRapidSettings(); });
+        Menu::Item::action(
+            "SaveRpd", "Press A", [](Menu &m, int)
+            {
+                DPRINT(("save rapid state\n"));
+                textScreen_.printInfo(0, 1, "  Saved ");
+                textScreen_.setInfoLayerClearTimer(CPU_CLOCK);
+                saveRapidSettings(); }),
+
+        Menu::Item::select("RotEncX", &appConfig_.rotEnc[0].axis, rotEncAxisText, onRotEncChanged)
+            .setContext(0),
+        Menu::Item::select("RotEncY", &appConfig_.rotEnc[1].axis, rotEncAxisText, onRotEncChanged)
+            .setContext(1),
+
+        Menu::Item::number(
+            "REncX S", &appConfig_.rotEnc[0].scale, {1, 256}, [](char *buf, size_t bufSize, int v, int)
+            { snprintf(buf, bufSize, "%3d", v); },
+            onRotEncChanged)
+            .setConditionFunc(isRotEncEnabled)
+            .setContext(0),
+        Menu::Item::number(
+            "REncY S", &appConfig_.rotEnc[1].scale, {1, 256}, [](char *buf, size_t bufSize, int v, int)
+            { snprintf(buf, bufSize, "%3d", v); },
+            onRotEncChanged)
+            .setConditionFunc(isRotEncEnabled)
+            .setContext(1),
+        Menu::Item::select("REncX M", &appConfig_.rotEnc[0].mode, rotEncModeText, onRotEncChanged)
+            .setConditionFunc(isRotEncEnabled)
+            .setContext(0),
+        Menu::Item::select("REncY M", &appConfig_.rotEnc[1].mode, rotEncModeText, onRotEncChanged)
+            .setConditionFunc(isRotEncEnabled)
+            .setContext(1),
+        Menu::Item::select("RotEncX", &appConfig_.rotEnc[0].reverse, reverseText, onRotEncChanged)
+            .setConditionFunc(isRotEncEnabled)
+            .setContext(0),
+        Menu::Item::select("RotEncY", &appConfig_.rotEnc[1].reverse, reverseText, onRotEncChanged)
+            .setConditionFunc(isRotEncEnabled)
+            .setContext(1),
+
+        Menu::Item::select("2PortMd", &appConfig_.twinPortMode, onOffText,
+                           [](Menu &m, int)
+                           { setTwinPortSetting(); }),
+
+        Menu::Item::action("InitAll", "PressA+S", [](Menu &m, int)
+                           {
+            auto pad = m.getPad();
+            if (pad.first & (1 << static_cast<int>(PadStateButton::START)))
+            {
+                DPRINT(("init all\n"));
+                textScreen_.printInfo(0, 1, " Init'd ");
+                textScreen_.setInfoLayerClearTimer(CPU_CLOCK);
+                resetConfigs();
+            } }),
+    };
 
-    menu_.append(
-        "SaveRpd", "Press A", [](Menu &m)
-        {
-            DPRINT(("save rapid state\n"));
-            textScreen_.printInfo(0, 1, "  Saved ");
-            textScreen_.setInfoLayerClearTimer(CPU_CLOCK);
-            saveRapidSettings(); });
+#undef MAKE_ANALOG_SETTING_ITEMS
+}
 
-    static const char *rotEncAxisText[] = {"None", "Axis X", "Axis Y", "Axis Z", "Axis RX", "Axis RY", "Axis RZ", "SLIDER", "DIAL", "WHEEL"};
-    menu_.append("RotEncX", &appConfig_.rotEnc[0].axis, rotEncAxisText, std::size(rotEncAxisText), [&](Menu &m)
-                 { setRotEncSettings(0); });
-    menu_.append("RotEncY", &appConfig_.rotEnc[1].axis, rotEncAxisText, std::size(rotEncAxisText), [&](Menu &m)
-                 { setRotEncSettings(1); });
+void initMenu()
+{
+    menu_.setBlinkInterval(CPU_CLOCK / 2);
 
-    auto rotEncXCond = []()
-    {
-        return appConfig_.rotEnc[0].axis != 0;
-    };
-    auto rotEncYCond = []()
-    {
-        return appConfig_.rotEnc[1].axis != 0;
-    };
-    menu_.append(
-             "REncX S", &appConfig_.rotEnc[0].scale, {1, 256}, [](char *buf, size_t bufSize, int v)
-             { snprintf(buf, bufSize, "%3d", v); },
-             [&](Menu &m)
-             { setRotEncSettings(0); })
-        .setConditionFunc(rotEncXCond);
-    menu_.append(
-             "REncY S", &appConfig_.rotEnc[1].scale, {1, 256}, [](char *buf, size_t bufSize, int v)
-             { snprintf(buf, bufSize, "%3d", v); },
-             [&](Menu &m)
-             { setRotEncSettings(1); })
-        .setConditionFunc(rotEncYCond);
-    menu_.append(
-             "RotEncX", &appConfig_.rotEnc[0].reverse, reverseText, std::size(reverseText), [&](Menu &m)
-             { setRotEncSettings(0); })
-        .setConditionFunc(rotEncXCond);
-    menu_.append(
-             "RotEncY", &appConfig_.rotEnc[1].reverse, reverseText, std::size(reverseText), [&](Menu &m)
-             { setRotEncSettings(1); })
-        .setConditionFunc(rotEncYCond);
-
-    menu_.append("2PortMd", &appConfig_.twinPortMode, onOffText, std::size(onOffText),
-                 [&](Menu &m)
-                 { setTwinPortSetting(); });
-
-    menu_.append("InitAll", "PressA+S", [](Menu &m)
-                 {
-        auto pad = m.getPad();
-        if (pad.first & (1 << static_cast<int>(PadStateButton::START)))
+    PadManager::instance().setOnExitConfigFunc(
+        []
         {
-            DPRINT(("init all\n"));
-            textScreen_.printInfo(0, 1, " Init'd ");
-            textScreen_.setInfoLayerClearTimer(CPU_CLOCK);
-            resetConfigs();
-        } });
+            DPRINT(("exit button config\n"));
+            textScreen_.clearAll();
+            menu_.forceClose();
+            menu_.refresh();
+        });
+
+    menu_.setItems(menuItems_);
 
     menu_.setOpenCloseFunc(
         [](bool open)
@@ -1113,6 +1429,7 @@ void initMenu()
                 textScreen_.setFont(5, getUpArrowFont());
                 textScreen_.print(0, 0, TextScreen::Layer::BASE, "\240\2");
                 textScreen_.print(0, 1, TextScreen::Layer::BASE, "\1\3");
+                invalidateStatusDisplay();
 
                 if (menu_.isChanged())
                 {
@@ -1173,6 +1490,8 @@ public:
 
         if (st != prevSt_ || dirty_)
         {
+            TRACE(PIN_OUT, 2, 0, st3);
+            TRACE(PIN_OUT, 3, 0, st4);
             // printf("dir = %04x\n", st);
             pca95555MPExt_.setPortDirNonBlocking(st);
             prevSt_ = st;
@@ -1204,6 +1523,27 @@ namespace
     auto *i2cIF_ = i2c1;
 
     MultiPlayerAdapter multiPlayerAdapter_;
+
+    // ステータス表示の内容を決める値. 変わったときだけ描き直す
+    // memcmp で比べるので隙間のできない型だけにする
+    struct StatusDisplayState
+    {
+        int line2Port;
+        int buttonDispMode;
+        int blink; // 点滅するボタンがあるときだけ
+        int rapidDiv[2];
+        std::array<uint32_t, 2> buttons[2]; // RAPID_BUTTONS は [0] にマスク
+        int fpsKind;                        // 0: 非表示, 1: FPS, 2: 水平周波数, 3: ライン数
+        int fpsValue;
+        int sync; // 0: software, 1: 同期中, 2: 外れている
+    };
+    StatusDisplayState statusDisplay_{};
+    bool statusDisplayDirty_ = true;
+}
+
+void invalidateStatusDisplay()
+{
+    statusDisplayDirty_ = true;
 }
 
 void updateDisplay(uint32_t dclk)
@@ -1226,7 +1566,6 @@ void updateDisplay(uint32_t dclk)
     // 2P以降で最後に更新されたポートを探す
     static uint32_t prevButtons[PadManager::N_OUTPUT_PORTS]{};
     static int line2Port = 1;
-    auto prevLine2Port = line2Port;
     if (multiPlayerAdapter_)
     {
         for (int i = PadManager::N_OUTPUT_PORTS - 1; i >= 1; --i)
@@ -1244,26 +1583,81 @@ void updateDisplay(uint32_t dclk)
         line2Port = 1;
     }
 
-    if (line2Port != prevLine2Port)
+    auto &padManager = PadManager::instance();
+
+    StatusDisplayState st{};
+    st.line2Port = line2Port;
+    st.buttonDispMode = appConfig_.buttonDispMode;
+    for (int line = 0; line < 2; ++line)
     {
-        textScreen_.setFont(1, getPlayerFont(line2Port));
+        int port = line == 0 ? 0 : line2Port;
+        st.rapidDiv[line] = padManager.getRapidFireDiv(port);
+
+        switch (appConfig_.getButtonDispMode())
+        {
+        case AppConfig::ButtonDispMode::INPUT_BUTTONS:
+            st.buttons[line] = padManager.getNonRapidButtonsEachRapidPhase(port);
+            if (st.buttons[line][0] != st.buttons[line][1])
+            {
+                st.blink = blink;
+            }
+            break;
+
+        case AppConfig::ButtonDispMode::RAPID_BUTTONS:
+            st.buttons[line][0] = padManager.getRapidFireMask(port);
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    if (appConfig_.dispFPS)
+    {
+        st.fpsKind = 1;
+        if (appConfig_.dispFPS == 2)
+        {
+            // FPS, 水平周波数, ライン数を 2 秒ごとに切り替える
+            st.fpsKind += time_us_64() / 2000000 % 3;
+        }
+        switch (st.fpsKind)
+        {
+        case 1:
+            st.fpsValue = vsyncDetector_.getFPS100();
+            break;
+        case 2:
+            st.fpsValue = hsyncDetector_.getLineFreq100Hz();
+            break;
+        case 3:
+            st.fpsValue = hsyncDetector_.getLinesPerFrame() * 2 + hsyncDetector_.isInterlace();
+            break;
+        }
     }
 
-    auto buttonDispMode = appConfig_.buttonDispMode;
+    // synchro 連射の同期状態. 外れている間は software で代用している
+    if (appConfig_.rapidModeSynchro)
+    {
+        st.sync = vsyncDetector_.isLocked() ? 1 : 2;
+    }
 
-    auto &padManager = PadManager::instance();
-    for (int line = 0; line < 2; ++line)
+    if (!statusDisplayDirty_ && memcmp(&st, &statusDisplay_, sizeof(st)) == 0)
     {
-        int port = line == 0 ? 0 : line2Port;
+        return;
+    }
+    statusDisplayDirty_ = false;
+    statusDisplay_ = st;
+
+    textScreen_.setFont(1, getPlayerFont(line2Port));
 
-        int rapidDiv = padManager.getRapidFireDiv(port);
-        textScreen_.setFont(2 + line, get1_NFont(rapidDiv));
+    for (int line = 0; line < 2; ++line)
+    {
+        textScreen_.setFont(2 + line, get1_NFont(st.rapidDiv[line]));
 
         switch (appConfig_.getButtonDispMode())
         {
         case AppConfig::ButtonDispMode::INPUT_BUTTONS:
         {
-            auto rbt = padManager.getNonRapidButtonsEachRapidPhase(port);
+            const auto &rbt = st.buttons[line];
 
             char buf[7];
             int ofs = 0;
@@ -1285,7 +1679,7 @@ void updateDisplay(uint32_t dclk)
 
         case AppConfig::ButtonDispMode::RAPID_BUTTONS:
         {
-            auto mask = padManager.getRapidFireMask(port);
+            auto mask = st.buttons[line][0];
 
             char buf[7];
             int ofs = 0;
@@ -1307,9 +1701,21 @@ void updateDisplay(uint32_t dclk)
         }
     }
 
-    if (appConfig_.dispFPS)
+    if (st.fpsKind)
     {
-        auto fpsStr = vsyncDetector_.getFPSString();
+        std::array<char, 6> fpsStr;
+        switch (st.fpsKind)
+        {
+        default:
+            fpsStr = vsyncDetector_.getFPSString();
+            break;
+        case 2:
+            fpsStr = hsyncDetector_.getLineFreqString();
+            break;
+        case 3:
+            fpsStr = hsyncDetector_.getLinesString();
+            break;
+        }
 #if 0
         int d0 = fpsStr[1] - '0';
         if (d0 >= 0 && d0 <= 9)
@@ -1320,6 +1726,15 @@ void updateDisplay(uint32_t dclk)
 #endif
         textScreen_.print(3, 1, TextScreen::Layer::BASE, fpsStr.data());
     }
+
+    if (st.sync)
+    {
+        textScreen_.print(2, 1, TextScreen::Layer::BASE, st.sync == 1 ? "=" : "?");
+    }
+    else
+    {
+        textScreen_.print(2, 1, TextScreen::Layer::BASE, " ");
+    }
 }
 
 class SwRapidFire
@@ -1341,6 +1756,61 @@ public:
             ++counter_;
         }
     }
+
+    // 次の切り替えを今から 1 周期後にする
+    void resetPhase() { clk_ = 0; }
+};
+
+// synchro と software の連射カウンタを切り替える
+// 切り替えてもカウンタは連続し, 短すぎるパルスも出さない
+class RapidFireSelector
+{
+    uint32_t counter_ = 0;
+    uint32_t prevVSync_ = 0;
+    uint32_t prevSw_ = 0;
+
+    bool useVSync_ = false;
+    uint64_t handoverTime_ = 0;
+
+public:
+    uint32_t getCounter() const { return counter_; }
+    bool isVSync() const { return useVSync_; }
+
+    void update(bool wantVSync, uint32_t vsyncCount, uint32_t framePeriod,
+                SwRapidFire &sw, uint64_t now)
+    {
+        uint32_t dv = vsyncCount - prevVSync_;
+        uint32_t ds = sw.getCounter() - prevSw_;
+        prevVSync_ = vsyncCount;
+        prevSw_ = sw.getCounter();
+
+        if (useVSync_)
+        {
+            if (wantVSync)
+            {
+                // 切り替え直後の半フレーム以内のフリップは捨てる
+                if (now - handoverTime_ >= framePeriod / 2)
+                {
+                    counter_ += dv;
+                }
+                return;
+            }
+
+            // 同期が外れた. software はここから 1 周期後に切り替える
+            useVSync_ = false;
+            sw.resetPhase();
+            return;
+        }
+
+        counter_ += ds;
+
+        // software が切り替わった直後に synchro へ移る
+        if (wantVSync && ds)
+        {
+            useVSync_ = true;
+            handoverTime_ = now;
+        }
+    }
 };
 
 void initDevices()
@@ -1354,6 +1824,15 @@ void initDevices()
 
 void updateJAMMAOutput(uint32_t st, int port, bool hasMultiPlayerAdapter)
 {
+#ifdef ENABLE_TRACE
+    static uint32_t prevSt[2] = {~0u, ~0u};
+    if (st != prevSt[port])
+    {
+        prevSt[port] = st;
+        TRACE(PIN_OUT, port, 0, st);
+    }
+#endif
+
     if (REVERSE_STATE)
     {
         st = ~st;
@@ -1366,8 +1845,13 @@ void updateJAMMAOutput(uint32_t st, int port, bool hasMultiPlayerAdapter)
     for (auto i = 0; i < n; ++i)
     {
         auto &m = map[i];
-        gpio_put(static_cast<int>(m.gpio),
-                 st & (1u << static_cast<int>(m.padState)));
+        auto pin = static_cast<int>(m.gpio);
+        if (rotEncGPIOMask_ & (1u << pin))
+        {
+            // ロータリーエンコーダのタイマーが出力している
+            continue;
+        }
+        gpio_put(pin, st & (1u << static_cast<int>(m.padState)));
     }
 
     auto &ast = PadManager::instance().getAnalogState(port);
@@ -1376,6 +1860,7 @@ void updateJAMMAOutput(uint32_t st, int port, bool hasMultiPlayerAdapter)
 
 void updateOutput()
 {
+    MEMSTAT_SCOPE(INPUT);
     bool hasMPAdapter = !!multiPlayerAdapter_;
 
     auto &padManager = PadManager::instance();
@@ -1407,6 +1892,9 @@ void setUSBIniitalized(bool f); // hid_app.cpp
 
 bool powerOn()
 {
+    // PDPG は UART の TX と兼用なので送り終えてから切り替える
+    LOG_FLUSH();
+
     // check Power good
     gpio_init(PDPG_PIN);
     gpio_set_dir(PDPG_PIN, GPIO_IN);
@@ -1422,8 +1910,9 @@ bool powerOn()
     if (powerGood)
     {
         gpio_put(POWER_EN_PIN, true);
-        printf("power on\n");
+        LOG(("power on\n"));
 
+        rotEncOutputEnabled_ = true;
         applySettings();
 
         // initDevice 時に5V電源が必要な可能性があるので、安定するまで待つ
@@ -1443,12 +1932,15 @@ bool powerOn()
             menu_.refresh();
         }
 
+        // ブートプロトコルのままだとディスクリプタと形式が合わないことがある
+        // マウス等も列挙中にレポートプロトコルにしておく
+        tuh_hid_set_default_protocol(HID_PROTOCOL_REPORT);
         tusb_init();
         setUSBIniitalized(true);
     }
     else
     {
-        printf("power NOT good\n");
+        LOG(("power NOT good\n"));
         if (HAS_LCD)
         {
             textScreen_.printInfo(0, 0, "POWER NG");
@@ -1466,6 +1958,8 @@ void powerOff()
     setUSBIniitalized(false);
     tuh_deinit(0);
 
+    rotEncOutputEnabled_ = false;
+    updateRotEncOutput();
     initButtonGPIO();
 
     if (HAS_POWER_BUTTON)
@@ -1474,7 +1968,7 @@ void powerOff()
     }
     vsyncDetector_.setEnableFPSCount(false);
 
-    printf("power off\n");
+    LOG(("power off\n"));
     if (HAS_LCD)
     {
         menu_.forceClose();
@@ -1487,6 +1981,8 @@ void powerOff()
 
 void i2cTest()
 {
+    LOG_FLUSH();
+
     // check Power good
     gpio_init(PDPG_PIN);
     gpio_set_dir(PDPG_PIN, GPIO_IN);
@@ -1506,7 +2002,8 @@ void i2cTest()
     }
 
     gpio_put(POWER_EN_PIN, true);
-    printf("power on\n");
+    LOG(("power on\n"));
+    LOG_FLUSH();
 
     sleep_ms(200);
 
@@ -1516,11 +2013,39 @@ void i2cTest()
     }
 }
 
+// UART からのデバッグ用の要求
+void pollDebugRequest()
+{
+#if defined(ENABLE_PROFILER) || defined(ENABLE_TRACE) || defined(ENABLE_MEMSTAT)
+    int c = getchar_timeout_us(0);
+    if (c < 0)
+    {
+        return;
+    }
+#ifdef ENABLE_PROFILER
+    profiler::handleRequest(c);
+#endif
+#ifdef ENABLE_TRACE
+    trace::handleRequest(c);
+#endif
+#ifdef ENABLE_MEMSTAT
+    memstat::handleRequest(c);
+#endif
+#endif
+}
+
 ////////////////////////
 ////////////////////////
 int main()
 {
+#ifdef ENABLE_MEMSTAT
+    // 何かがスタックを使う前に塗っておく
+    memstat::init();
+#endif
     stdio_init_all();
+#ifdef ENABLE_ASYNC_LOG
+    logger::init();
+#endif
 
 #ifdef RASPBERRYPI_PICO_W
     if (cyw43_arch_init())
@@ -1579,10 +2104,7 @@ int main()
 
     // ADC
     initADC();
-    startADC();
-
-    // DAC
-    initDACTable();
+    startADC(getRequiredADCMode());
 
 #ifdef NDEBUG
     watchdog_enable(5000, true);
@@ -1593,6 +2115,7 @@ int main()
     padManager.setOnSaveFunc(save);
 
     SwRapidFire swRapidFire;
+    RapidFireSelector rapidFireSelector;
 
     if (appConfig_.initPowerOn && !power)
     {
@@ -1602,11 +2125,25 @@ int main()
 
     buttonWatcher_.init();
 
+#ifdef ENABLE_MEMSTAT
+    // ここからは入力の経路でヒープを使わない
+    memstat::setSteadyState(true);
+#endif
+
     while (1)
     {
+        PROFILE_BEGIN(LOOP);
         watchdog_update();
 
+        PROFILE_BEGIN(BUTTON);
         auto cdct = buttonWatcher_.update();
+        PROFILE_END(BUTTON);
+        uint32_t uiClk;
+        uint32_t uiCycles = 0;
+        vsyncDetector_.setFetchPhase(appConfig_.synchroFetchPhase);
+        vsyncDetector_.updateTiming(time_us_64());
+        updateADCMode();
+        updateHSyncDetector();
 
         if (!power && HAS_POWER_BUTTON)
         {
@@ -1648,41 +2185,54 @@ int main()
             {
                 if (HAS_LCD && padManager.isNormalMode())
                 {
+                    PROFILE_BEGIN(MENU);
+                    MEMSTAT_SCOPE(MENU);
                     menu_.update(cdct,
                                  nrb,
                                  buttonWatcher_.isPushed(),
                                  buttonWatcher_.isReleaseEdge(),
                                  buttonWatcher_.isMiddleEdge());
+                    PROFILE_END(MENU);
                 }
 
-                if (appConfig_.rapidModeSynchro)
-                {
-                    padManager.setVSyncCount(vsyncDetector_.getCounter());
-                }
-                else
-                {
-                    swRapidFire.update(cdct, appConfig_.softwareRapidSpeed);
-                    padManager.setVSyncCount(swRapidFire.getCounter());
-                }
+                // 同期が取れていなければ software にフォールバックする
+                swRapidFire.update(cdct, appConfig_.softwareRapidSpeed);
+                rapidFireSelector.update(appConfig_.rapidModeSynchro && vsyncDetector_.isLocked(),
+                                          vsyncDetector_.getCounter(),
+                                          vsyncDetector_.getFramePeriod(),
+                                          swRapidFire, time_us_64());
+                padManager.setVSyncCount(rapidFireSelector.getCounter());
 
+                PROFILE_BEGIN(PAD);
                 padManager.update(cdct,
                                   buttonWatcher_.isPushed(),
                                   buttonWatcher_.isReleaseEdge(),
                                   buttonWatcher_.isMiddleEdge());
+                PROFILE_END(PAD);
 
+                PROFILE_BEGIN(OUTPUT);
                 updateOutput();
+                PROFILE_END(OUTPUT);
 
                 if (HAS_LCD && padManager.isNormalMode())
                 {
+                    PROFILE_BEGIN(DISPLAY);
+                    uiClk = util::getSysTickCounter24();
                     updateDisplay(cdct);
                     menu_.render();
+                    uiCycles = (uiClk - util::getSysTickCounter24()) & 0xffffff;
+                    PROFILE_END(DISPLAY);
                 }
             }
         }
 
         if (HAS_LCD)
         {
+            PROFILE_BEGIN(TEXT_SCREEN);
+            uiClk = util::getSysTickCounter24();
             textScreen_.update(cdct);
+            uiCycles_.add(uiCycles + ((uiClk - util::getSysTickCounter24()) & 0xffffff));
+            PROFILE_END(TEXT_SCREEN);
 
             bool info = textScreen_.isInfoActive();
             bool led = (power || info) && appConfig_.backLight;
@@ -1691,8 +2241,35 @@ int main()
             LCD::instance().setDisplayOnOff(info || power);
         }
 
+        PROFILE_BEGIN(USB);
         tuh_task();
+        PROFILE_END(USB);
+
+        PROFILE_BEGIN(MIDI);
         updateMIDIState();
+        PROFILE_END(MIDI);
+
+        PROFILE_BEGIN(SAVE);
+        updateSave(time_us_64());
+        PROFILE_END(SAVE);
+
+#ifdef ENABLE_MEMSTAT
+        // 設定を足し続けてヒープが尽きる前に知らせる
+        if (memstat::update(time_us_64()) && HAS_LCD)
+        {
+            textScreen_.printInfo(0, 0, "MEM LOW");
+            textScreen_.printInfo(0, 1, "UART: m");
+            textScreen_.setInfoLayerClearTimer(CPU_CLOCK * 2);
+        }
+#endif
+
+        PROFILE_END(LOOP);
+        pollDebugRequest();
+
+#ifdef ENABLE_ASYNC_LOG
+        // ログの送信は計測の外で
+        logger::update();
+#endif
     }
     return 0;
 }
@@ -0,0 +1,283 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 20:14:08
+ */
+
+#include "mem_stat.h"
+
+#ifdef ENABLE_MEMSTAT
+
+#include <malloc.h>
+#include <stdlib.h>
+#include <new>
+#include <pico/stdlib.h>
+#include "debug.h"
+
+// pico-sdk のリンカスクリプト
+extern "C"
+{
+    extern char __end__;
+    extern char __HeapLimit;
+    extern uint32_t __StackBottom;
+    extern uint32_t __StackTop;
+    extern uint32_t __StackOneBottom;
+    extern uint32_t __StackOneTop;
+}
+
+namespace memstat
+{
+    namespace
+    {
+        constexpr uint32_t STACK_PAINT = 0xa5a5a5a5;
+        // 塗るときに今の sp から空けておく量
+        constexpr uint32_t STACK_PAINT_MARGIN = 64;
+        constexpr uint64_t UPDATE_INTERVAL_US = 1000000;
+
+        size_t heapUsed_ = 0;
+        size_t heapPeak_ = 0;
+        size_t heapFree_ = 0;
+        TagStats tagStats_[N_TAGS]{};
+        Tag tag_ = Tag::OTHER;
+
+        bool steady_ = false;
+        uint32_t steadyAllocs_ = 0;
+
+        uint64_t nextUpdateTime_ = 0;
+        bool warned_ = false;
+
+        const char *tagNames_[N_TAGS] = {
+            "other",
+            "hid",
+            "xlat",
+            "menu",
+            "save",
+            "input",
+        };
+
+        void paint(uint32_t *p, uint32_t *end)
+        {
+            while (p < end)
+            {
+                *p++ = STACK_PAINT;
+            }
+        }
+
+        uint32_t getUsed(const uint32_t *bottom, const uint32_t *top)
+        {
+            auto *p = bottom;
+            while (p < top && *p == STACK_PAINT)
+            {
+                ++p;
+            }
+            return (top - p) * sizeof(uint32_t);
+        }
+
+        size_t getUsableSize(void *p)
+        {
+            return p ? malloc_usable_size(p) : 0;
+        }
+
+        void onAlloc(void *p)
+        {
+            if (!p)
+            {
+                return;
+            }
+            size_t size = getUsableSize(p);
+            heapUsed_ += size;
+            if (heapPeak_ < heapUsed_)
+            {
+                heapPeak_ = heapUsed_;
+            }
+            auto &s = tagStats_[static_cast<int>(tag_)];
+            ++s.count;
+            s.bytes += size;
+
+            if (steady_ && tag_ == Tag::INPUT)
+            {
+                ++steadyAllocs_;
+#ifndef NDEBUG
+                panic("memstat: %u bytes allocated on the input path", (unsigned)size);
+#endif
+            }
+        }
+
+        void onFree(void *p)
+        {
+            heapUsed_ -= getUsableSize(p);
+        }
+
+        void sampleHeapFree()
+        {
+            // sbrk でまだ取っていない分と, 取ったが空いている分
+            auto mi = mallinfo();
+            size_t total = &__HeapLimit - &__end__;
+            heapFree_ = total - mi.arena + mi.fordblks;
+        }
+    }
+
+    void init()
+    {
+        // core0 は今使っている所より下を塗る
+        auto *sp = static_cast<uint32_t *>(__builtin_frame_address(0));
+        paint(&__StackBottom, sp - STACK_PAINT_MARGIN / sizeof(uint32_t));
+        // core1 はまだ起動していない
+        paint(&__StackOneBottom, &__StackOneTop);
+
+        sampleHeapFree();
+    }
+
+    size_t getHeapUsed()
+    {
+        return heapUsed_;
+    }
+
+    size_t getHeapPeak()
+    {
+        return heapPeak_;
+    }
+
+    size_t getHeapFree()
+    {
+        return heapFree_;
+    }
+
+    const TagStats &getTagStats(Tag t)
+    {
+        return tagStats_[static_cast<int>(t)];
+    }
+
+    const char *getTagName(Tag t)
+    {
+        return tagNames_[static_cast<int>(t)];
+    }
+
+    StackStats getStackStats(int core)
+    {
+        auto *bottom = core ? &__StackOneBottom : &__StackBottom;
+        auto *top = core ? &__StackOneTop : &__StackTop;
+        return {static_cast<uint32_t>((top - bottom) * sizeof(uint32_t)), getUsed(bottom, top)};
+    }
+
+    bool update(uint64_t timeUS)
+    {
+        if (timeUS < nextUpdateTime_)
+        {
+            return false;
+        }
+        nextUpdateTime_ = timeUS + UPDATE_INTERVAL_US;
+
+        sampleHeapFree();
+
+        bool low = heapFree_ < HEAP_WARN_BYTES;
+        for (int core = 0; core < 2; ++core)
+        {
+            auto s = getStackStats(core);
+            // 使っていない core1 は used が 0
+            low |= s.used && s.size - s.used < STACK_WARN_BYTES;
+        }
+        if (!low || warned_)
+        {
+            return false;
+        }
+        warned_ = true;
+
+        LOG(("memstat: low memory!\n"));
+        dump();
+        return true;
+    }
+
+    void dump()
+    {
+        sampleHeapFree();
+        LOG(("heap: %u used, %u peak, %u free\n",
+             (unsigned)heapUsed_, (unsigned)heapPeak_, (unsigned)heapFree_));
+        for (int core = 0; core < 2; ++core)
+        {
+            auto s = getStackStats(core);
+            LOG(("stack%d: %u/%u\n", core, (unsigned)s.used, (unsigned)s.size));
+        }
+        for (int i = 0; i < N_TAGS; ++i)
+        {
+            const auto &s = tagStats_[i];
+            LOG(("alloc %-5s %7u times %8u bytes\n",
+                 tagNames_[i], (unsigned)s.count, (unsigned)s.bytes));
+        }
+        LOG(("steady: %d, %u allocs on the input path\n", steady_, (unsigned)steadyAllocs_));
+    }
+
+    void handleRequest(int c)
+    {
+        if (c == 'm')
+        {
+            dump();
+        }
+    }
+
+    void setSteadyState(bool f)
+    {
+        steady_ = f;
+    }
+
+    bool isSteadyState()
+    {
+        return steady_;
+    }
+
+    uint32_t getSteadyAllocCount()
+    {
+        return steadyAllocs_;
+    }
+
+    Tag getTag()
+    {
+        return tag_;
+    }
+
+    void setTag(Tag t)
+    {
+        tag_ = t;
+    }
+}
+
+// pico_standard_link の new/delete の代わり (PICO_CXX_DISABLE_ALLOCATION_OVERRIDES)
+// 例外は使わないので確保の失敗は pico_malloc の panic に任せる
+void *operator new(size_t size)
+{
+    void *p = malloc(size);
+    memstat::onAlloc(p);
+    return p;
+}
+
+void *operator new[](size_t size)
+{
+    void *p = malloc(size);
+    memstat::onAlloc(p);
+    return p;
+}
+
+void operator delete(void *p) noexcept
+{
+    memstat::onFree(p);
+    free(p);
+}
+
+void operator delete[](void *p) noexcept
+{
+    memstat::onFree(p);
+    free(p);
+}
+
+void operator delete(void *p, size_t) noexcept
+{
+    memstat::onFree(p);
+    free(p);
+}
+
+void operator delete[](void *p, size_t) noexcept
+{
+    memstat::onFree(p);
+    free(p);
+}
+
+#endif
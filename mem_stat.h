@@ -0,0 +1,96 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 20:14:08
+ */
+#pragma once
+
+// ヒープとスタックの使用量
+// operator new/delete を置き換えて現在量とピークを数える
+// 確保回数は MEMSTAT_SCOPE で囲んだ処理ごとに分ける
+// スタックは起動時に塗っておき, 塗りが残っていない所までを使用量とする
+// ENABLE_MEMSTAT が無ければマクロは空になる
+
+#ifdef ENABLE_MEMSTAT
+
+#include <stdint.h>
+#include <stddef.h>
+
+namespace memstat
+{
+    enum class Tag : uint8_t
+    {
+        OTHER,
+        HID,        // ディスクリプタ, レポートの解析
+        TRANSLATOR, // パッド設定
+        MENU,       // メニューとボタン設定モード
+        SERIALIZER, // 設定の保存と読み込み
+        INPUT,      // レポートから出力まで. 定常状態では確保しない
+        MAX,
+    };
+    inline constexpr int N_TAGS = static_cast<int>(Tag::MAX);
+
+    // 残りがこれを切ったら警告
+    inline constexpr size_t HEAP_WARN_BYTES = 16 * 1024;
+    inline constexpr size_t STACK_WARN_BYTES = 256;
+
+    struct TagStats
+    {
+        uint32_t count; // 確保した回数
+        uint32_t bytes; // 確保した量の合計
+    };
+
+    struct StackStats
+    {
+        uint32_t size;
+        uint32_t used; // 塗りが消えた所まで
+    };
+
+    // main の最初で呼ぶ. スタックを塗る
+    void init();
+
+    size_t getHeapUsed();
+    size_t getHeapPeak();
+    // ヒープ全体の残り (解放済みの断片も含む). update() で取り直す
+    size_t getHeapFree();
+    const TagStats &getTagStats(Tag t);
+    const char *getTagName(Tag t);
+    StackStats getStackStats(int core);
+
+    // 定常状態で INPUT の中で確保したら数える. NDEBUG でなければ止める
+    void setSteadyState(bool f);
+    bool isSteadyState();
+    uint32_t getSteadyAllocCount();
+
+    // 1秒ごとに残りを調べる. 初めて閾値を切ったときだけ true
+    bool update(uint64_t timeUS);
+
+    // UART に出す
+    void dump();
+    // UART からの要求. 'm' で dump
+    void handleRequest(int c);
+
+    Tag getTag();
+    void setTag(Tag t);
+
+    class Scope
+    {
+        Tag prev_;
+
+    public:
+        explicit Scope(Tag t) : prev_(getTag()) { setTag(t); }
+        ~Scope() { setTag(prev_); }
+        Scope(const Scope &) = delete;
+        Scope &operator=(const Scope &) = delete;
+    };
+}
+
+#define MEMSTAT_SCOPE(tag) memstat::Scope memstatScope_(memstat::Tag::tag)
+
+#else
+
+#define MEMSTAT_SCOPE(tag) \
+    do                     \
+    {                      \
+    } while (0)
+
+#endif
@@ -6,6 +6,7 @@
 #include "menu.h"
 #include "pad_state.h"
 #include "font.h"
+#include <algorithm>
 
 void Menu::setOpenCloseFunc(OpenCloseFunc f)
 {
@@ -18,6 +19,7 @@ void Menu::setOpenCloseFunc(OpenCloseFunc f)
 
 void Menu::refresh()
 {
+    dirty_ = true;
     textScreen_->clearLayer(layer_);
     if (onOpenClose_)
     {
@@ -42,6 +44,7 @@ void Menu::update(int dclk,
     {
         blinkCounter_ -= blinkInterval_;
         blinkPhase_ ^= true;
+        dirty_ = true;
     }
 
     pad_ = pad;
@@ -60,7 +63,7 @@ void Menu::update(int dclk,
     }
     else if (open_)
     {
-        auto &item = items_[currentItem_];
+        const auto &item = items_[currentItem_];
 
         if (testButton(PadStateButton::UP))
         {
@@ -74,24 +77,26 @@ void Menu::update(int dclk,
         {
             if (item.value)
             {
-                *item.value = std::max(item.range.first, *item.value - 1);
+                *item.value = std::max(item.minValue, *item.value - 1);
                 if (item.onValueChange)
                 {
-                    item.onValueChange(*this);
+                    item.onValueChange(*this, item.context);
                 }
                 changed_ = true;
+                dirty_ = true;
             }
         }
         else if (testButton(PadStateButton::RIGHT))
         {
             if (item.value)
             {
-                *item.value = std::min(item.range.second, *item.value + 1);
+                *item.value = std::min(item.maxValue, *item.value + 1);
                 if (item.onValueChange)
                 {
-                    item.onValueChange(*this);
+                    item.onValueChange(*this, item.context);
                 }
                 changed_ = true;
+                dirty_ = true;
             }
         }
         else
@@ -100,8 +105,9 @@ void Menu::update(int dclk,
                 ((item.menuButton && menuButtonLongPress) ||
                  (!item.menuButton && testButton(PadStateButton::A))))
             {
-                item.onButton(*this);
+                item.onButton(*this, item.context);
                 changed_ = true;
+                dirty_ = true;
             }
         }
     }
@@ -112,15 +118,24 @@ void Menu::update(int dclk,
     padPrev_ = pad;
 }
 
-void Menu::render() const
+void Menu::render()
 {
     if (!open_)
     {
         return;
     }
-    textScreen_->clearLayer(layer_);
 
-    auto &item = items_[currentItem_];
+    // valueFormat が値以外を表示する項目は blink の周期で更新される
+    const auto &item = items_[currentItem_];
+    int value = item.value ? *item.value : 0;
+    if (!dirty_ && value == renderedValue_)
+    {
+        return;
+    }
+    dirty_ = false;
+    renderedValue_ = value;
+
+    textScreen_->clearLayer(layer_);
     textScreen_->print(0, 0, layer_, item.name);
 
     if (item.valueTexts)
@@ -130,8 +145,7 @@ void Menu::render() const
     else if (item.valueFormat)
     {
         char buf[16];
-        // snprintf(buf, sizeof(buf), item.valueFormat, *item.value);
-        item.valueFormat(buf, sizeof(buf), *item.value);
+        item.valueFormat(buf, sizeof(buf), *item.value, item.context);
         textScreen_->print(0, 1, layer_, buf);
     }
     else if (item.valueText)
@@ -156,11 +170,11 @@ void Menu::nextItem(bool inc)
 
     do
     {
-        currentItem_ = (currentItem_ + dir + items_.size()) % items_.size();
-        auto &item = items_[currentItem_];
+        currentItem_ = (currentItem_ + dir + nItems_) % nItems_;
+        const auto &item = items_[currentItem_];
         if (item.conditionFunc)
         {
-            if (item.conditionFunc())
+            if (item.conditionFunc(item.context))
             {
                 break;
             }
@@ -170,4 +184,6 @@ void Menu::nextItem(bool inc)
             break;
         }
     } while (currentItem_ != prev);
+
+    dirty_ |= currentItem_ != prev;
 }
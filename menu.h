@@ -6,38 +6,93 @@
 #pragma once
 
 #include "text_screen.h"
-#include <string>
-#include <functional>
-#include <vector>
+#include <stddef.h>
+#include <stdint.h>
 #include <utility>
 
 class Menu
 {
 public:
-    using ActionFunc = std::function<void(Menu &)>;
-    using OpenCloseFunc = std::function<void(bool)>;
-    using ValueFormatFunc = std::function<void(char *, size_t, int)>;
-    using ConditionFunc = std::function<bool()>;
-
-    struct MenuItem
+    // ctx は Item::context. 同じ関数を複数の項目で使い分けるのに使う
+    using ActionFunc = void (*)(Menu &, int ctx);
+    using OpenCloseFunc = void (*)(bool);
+    using ValueFormatFunc = void (*)(char *, size_t, int v, int ctx);
+    using ConditionFunc = bool (*)(int ctx);
+
+    // 項目は constexpr の表で定義して flash に置く
+    struct Item
     {
-        const char *name;
+        const char *name{};
         int *value{};
-        std::pair<int, int> range{};
-        const char **valueTexts{};
+        int minValue{};
+        int maxValue{};
+        const char *const *valueTexts{};
         const char *valueText{};
-        // const char *valueFormat{};
-        ValueFormatFunc valueFormat;
+        ValueFormatFunc valueFormat{};
         bool menuButton = false; // onButton でMenuボタンを見る
+        int context{};
+
+        ActionFunc onValueChange{};
+        ActionFunc onButton{};
+        ConditionFunc conditionFunc{};
+
+        // 選択肢から選ぶ
+        template <size_t N>
+        static constexpr Item select(const char *name, int *value,
+                                     const char *const (&valueTexts)[N],
+                                     ActionFunc onValueChange = {})
+        {
+            Item item;
+            item.name = name;
+            item.value = value;
+            item.valueTexts = valueTexts;
+            item.maxValue = static_cast<int>(N) - 1;
+            item.onValueChange = onValueChange;
+            return item;
+        }
+
+        // 範囲内の値
+        static constexpr Item number(const char *name, int *value,
+                                     std::pair<int, int> range,
+                                     ValueFormatFunc valueFormat,
+                                     ActionFunc onValueChange = {},
+                                     ActionFunc onButton = {})
+        {
+            Item item;
+            item.name = name;
+            item.value = value;
+            item.minValue = range.first;
+            item.maxValue = range.second;
+            item.valueFormat = valueFormat;
+            item.onValueChange = onValueChange;
+            item.onButton = onButton;
+            return item;
+        }
+
+        // ボタンで実行する
+        static constexpr Item action(const char *name, const char *text,
+                                     ActionFunc onButton, bool menuButton = false)
+        {
+            Item item;
+            item.name = name;
+            item.valueText = text;
+            item.onButton = onButton;
+            item.menuButton = menuButton;
+            return item;
+        }
 
-        ActionFunc onValueChange;
-        ActionFunc onButton;
-        ConditionFunc conditionFunc;
+        constexpr Item setConditionFunc(ConditionFunc f) const
+        {
+            Item item = *this;
+            item.conditionFunc = f;
+            return item;
+        }
 
-        MenuItem &setConditionFunc(ConditionFunc f)
+        constexpr Item setContext(int ctx) const
         {
-            conditionFunc = f;
-            return *this;
+            Item item = *this;
+            item.context = ctx;
+            return item;
         }
     };
 
@@ -47,58 +102,13 @@ public:
     {
     }
 
-    MenuItem &append(const char *name, int *value,
-                     const char **valueTexts, size_t nValueTexts,
-                     ActionFunc onValueChange = {},
-                     ActionFunc onButton = {},
-                     bool menuButton = false)
-    {
-        MenuItem item;
-        item.name = name;
-        item.value = value;
-        item.valueTexts = valueTexts;
-        item.range = {0, static_cast<int>(nValueTexts) - 1};
-        item.onValueChange = onValueChange;
-        item.onButton = onButton;
-        item.menuButton = menuButton;
-        items_.push_back(item);
-
-        return items_.back();
-    }
-
-    MenuItem &append(const char *name, int *value,
-                     std::pair<int, int> range,
-                     //                const char *valueFormat,
-                     ValueFormatFunc valueFormat,
-                     ActionFunc onValueChange = {},
-                     ActionFunc onButton = {},
-                     bool menuButton = false)
+    void setItems(const Item *items, size_t n)
     {
-        MenuItem item;
-        item.name = name;
-        item.value = value;
-        item.range = range;
-        item.valueFormat = valueFormat;
-        item.onValueChange = onValueChange;
-        item.onButton = onButton;
-        item.menuButton = menuButton;
-        items_.push_back(item);
-
-        return items_.back();
-    }
-
-    MenuItem &append(const char *name, const char *text, ActionFunc onButton = {}, bool menuButton = false)
-    {
-        //        append(name, {}, {}, text, {}, onButton, menuButton);
-        MenuItem item;
-        item.name = name;
-        item.valueText = text;
-        item.onButton = onButton;
-        item.menuButton = menuButton;
-        items_.push_back(item);
-
-        return items_.back();
+        items_ = items;
+        nItems_ = n;
     }
+    template <size_t N>
+    void setItems(const Item (&items)[N]) { setItems(items, N); }
 
     void refresh();
     void update(int dclk,
@@ -106,7 +116,9 @@ public:
                 bool menuButtonPress,
                 bool menuButtonRelease,
                 bool menuButtonLongPress);
-    void render() const;
+    // 表示が変わったときだけ描き直す
+    void render();
+    void invalidate() { dirty_ = true; }
 
     bool isOpened() const { return open_; }
     void setBlinkInterval(int interval) { blinkInterval_ = interval; }
@@ -130,7 +142,8 @@ private:
     TextScreen *textScreen_;
     TextScreen::Layer layer_ = TextScreen::Layer::MAIN;
 
-    std::vector<MenuItem> items_;
+    const Item *items_{};
+    size_t nItems_ = 0;
 
     bool open_ = false;
     int currentItem_ = -1;
@@ -141,7 +154,10 @@ private:
     int blinkInterval_ = 1;
     bool blinkPhase_ = 0;
 
-    OpenCloseFunc onOpenClose_;
+    bool dirty_ = true;
+    int renderedValue_ = 0;
+
+    OpenCloseFunc onOpenClose_{};
     bool changed_ = false;
 
     bool openLock_ = false;
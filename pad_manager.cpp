@@ -9,6 +9,7 @@
 #include <algorithm>
 #include "led.h"
 #include "debug.h"
+#include "mem_stat.h"
 
 namespace
 {
@@ -66,6 +67,7 @@ namespace
 }
 
 PadManager::PadManager()
+    : translator_(N_CACHED_CONFIGS)
 {
     using T = PadConfig::Type;
     using AP = PadConfig::AnalogPos;
@@ -102,8 +104,10 @@ void PadManager::reset()
 
 void PadManager::update(int dclk, bool cnfButton, bool cnfButtonTrigger, bool cnfButtonLong)
 {
+    MEMSTAT_SCOPE(INPUT);
     if (modeHandler_)
     {
+        MEMSTAT_SCOPE(MENU);
         modeHandler_->update(*this, dclk, cnfButton, cnfButtonTrigger, cnfButtonLong);
     }
     else
@@ -119,11 +123,11 @@ void PadManager::update(int dclk, bool cnfButton, bool cnfButtonTrigger, bool cn
         for (int j = 0; j < 2; ++j)
         {
             auto &re = rotEncoders_[i][j];
-            if (re)
+            if (re && re.getMode() == RotEncoder::Mode::VELOCITY)
             {
-                int axis = re.getAxis();
-                auto v = (latestPadData_[i].analogs[axis] >> (ANALOG_BITS - 8)) - 127;
-                re.update(dclk, v);
+                // analogs は 0..255
+                // 位置モードはレポートが来たときだけ setData() で渡す
+                re.setVelocity(latestPadData_[i].analogs[re.getAxis()] - 128);
             }
         }
     }
@@ -131,24 +135,27 @@ void PadManager::update(int dclk, bool cnfButton, bool cnfButtonTrigger, bool cn
 
 void PadManager::enterNormalMode()
 {
-    modeHandler_.reset();
+    // 呼び出し元の ModeHandler の中から来ることがあるので, ここでは壊さない
+    modeHandler_ = nullptr;
 
-    printf("to normal mode\n");
+    LOG(("to normal mode\n"));
     setLED(normalModeLED_);
 }
 
 void PadManager::enterConfigMode()
 {
-    modeHandler_ = std::make_unique<ButtonConfigMode>();
+    MEMSTAT_SCOPE(MENU);
+    modeHandler_ = &modeStorage_.emplace<ButtonConfigMode>();
     modeHandler_->init(*this);
-    printf("enter config mode\n");
+    LOG(("enter config mode\n"));
 }
 
 void PadManager::enterAnalogConfigMode()
 {
-    modeHandler_ = std::make_unique<AnalogConfigMode>();
+    MEMSTAT_SCOPE(MENU);
+    modeHandler_ = &modeStorage_.emplace<AnalogConfigMode>();
     modeHandler_->init(*this);
-    printf("enter ANALOG config mode\n");
+    LOG(("enter ANALOG config mode\n"));
 }
 
 void PadManager::blinkLED(bool reverse, int n) const
@@ -188,6 +195,23 @@ void PadManager::setData(int port, const PadInput &input)
                                   input.vid, input.pid, i,
                                   input.buttons.data(), N_BUTTONS,
                                   input.analogs.data(), N_ANALOGS, input.hat);
+                ++reportCounts_[p];
+            }
+        }
+
+        if (port < N_OUTPUT_PORTS)
+        {
+            // マウス等の移動量と位置モードの軸はレポート毎に渡す
+            for (auto &re : rotEncoders_[port])
+            {
+                if (re)
+                {
+                    re.addRelative(input.relatives[re.getAxis()]);
+                    if (re.getMode() != RotEncoder::Mode::VELOCITY)
+                    {
+                        re.setPosition(input.analogs[re.getAxis()]);
+                    }
+                }
             }
         }
     }
@@ -195,6 +219,68 @@ void PadManager::setData(int port, const PadInput &input)
     latestPadData_[port] = input;
 }
 
+void PadManager::preloadConfig(int vid, int pid)
+{
+    MEMSTAT_SCOPE(TRANSLATOR);
+    MountedDevice *slot = nullptr;
+    for (auto &d : mountedDevices_)
+    {
+        if (d.count && d.vid == vid && d.pid == pid)
+        {
+            slot = &d;
+            break;
+        }
+        if (!d.count && !slot)
+        {
+            slot = &d;
+        }
+    }
+    if (slot)
+    {
+        slot->vid = vid;
+        slot->pid = pid;
+        ++slot->count;
+    }
+
+    translator_.find(vid, pid, 0);
+    if (twinPortMode_)
+    {
+        translator_.find(vid, pid, 1);
+    }
+}
+
+void PadManager::releaseConfig(int vid, int pid)
+{
+    for (auto &d : mountedDevices_)
+    {
+        if (d.count && d.vid == vid && d.pid == pid)
+        {
+            if (--d.count == 0)
+            {
+                translator_.dropCache(vid, pid);
+            }
+            return;
+        }
+    }
+}
+
+void PadManager::setTwinPortMode(bool f)
+{
+    if (f && !twinPortMode_)
+    {
+        // 2P側の設定は preloadConfig() で展開していないので, ここで展開する
+        MEMSTAT_SCOPE(TRANSLATOR);
+        for (auto &d : mountedDevices_)
+        {
+            if (d.count)
+            {
+                translator_.find(d.vid, d.pid, 1);
+            }
+        }
+    }
+    twinPortMode_ = f;
+}
+
 void PadManager::setVSyncCount(int count)
 {
     for (auto &s : padStates_)
@@ -336,6 +422,11 @@ void PadManager::deserialize(Deserializer &s)
     translator_.deserialize(s);
 }
 
+void PadManager::onConfigStored(const uint8_t *image, size_t size)
+{
+    translator_.rebind(image, size);
+}
+
 void PadManager::setLED(bool on) const
 {
     if (enableLED_)
@@ -344,13 +435,14 @@ void PadManager::setLED(bool on) const
     }
 }
 
-void PadManager::setRotEncSetting(int kind, int axis, int scale)
+void PadManager::setRotEncSetting(int kind, int axis, int scale, RotEncoder::Mode mode)
 {
     for (int i = 0; i < N_OUTPUT_PORTS; ++i)
     {
         auto &re = rotEncoders_[i][kind];
         re.setAxis(axis);
         re.setScale(scale);
+        re.setMode(mode);
     }
 }
 
@@ -364,6 +456,15 @@ PadManager::getAnalogState(int port) const
     return padStates_[port].getAnalogState();
 }
 
+uint32_t PadManager::getReportCount(int port) const
+{
+    if (port < 0 || port >= N_OUTPUT_PORTS)
+    {
+        port = 0;
+    }
+    return reportCounts_[port];
+}
+
 ////////////
 // Button Config Mode
 void PadManager::ButtonConfigMode::init(PadManager &mgr)
@@ -387,7 +488,7 @@ void PadManager::ButtonConfigMode::init(PadManager &mgr)
 void PadManager::ButtonConfigMode::printMessage(const PadManager &mgr) const
 {
     auto bt = static_cast<PadStateButton>(curButton_);
-    printf("Wait for Button '%s'\n", toString(bt));
+    LOG(("Wait for Button '%s'\n", toString(bt)));
 
     if (mgr.printButtonFunc_)
     {
@@ -433,7 +534,7 @@ void PadManager::ButtonConfigMode::update(PadManager &mgr, int dclk, bool cnfBut
     else if (cnfButtonTrigger && !curButtonSet_.hasData())
     {
         // このボタン設定をスキップ
-        printf("skip.\n");
+        LOG(("skip.\n"));
         next(mgr);
     }
 
@@ -510,7 +611,7 @@ void PadManager::ButtonConfigMode::setData(PadManager &mgr, int port, const PadI
         {
             // 最初のボタンが入力された
             port_ = port;
-            printf("configure port %d...\n", port);
+            LOG(("configure port %d...\n", port));
         }
     }
 }
@@ -523,7 +624,8 @@ int PadManager::ButtonConfigMode::nButtons(const PadManager &mgr) const
 
 void PadManager::ButtonConfigMode::next(PadManager &mgr)
 {
-    buttonSets_.push_back(curButtonSet_);
+    assert(nButtonSets_ < MAX_BUTTON_SETS);
+    buttonSets_[nButtonSets_++] = curButtonSet_;
     curButtonSet_.clear();
 
     curButton_ = curButton_ + 1;
@@ -575,13 +677,13 @@ void PadManager::ButtonConfigMode::registerUnits(PadManager &mgr,
 
 void PadManager::ButtonConfigMode::saveAndExit(PadManager &mgr)
 {
-    auto &sets = buttonSets_;
-    if (!sets.empty())
+    if (nButtonSets_)
     {
         std::vector<PadConfig::Unit> units[2]; // 1P, 2P同時設定する事がある
         int index = 0;
-        for (auto &s : sets)
+        for (int setIndex = 0; setIndex < nButtonSets_; ++setIndex)
         {
+            auto &s = buttonSets_[setIndex];
             int subIndex = 0;
             for (int i = 0; i < N_BUTTONS; ++i)
             {
@@ -649,7 +751,7 @@ void PadManager::ButtonConfigMode::saveAndExit(PadManager &mgr)
 void PadManager::AnalogConfigMode::printMessage(const PadManager &mgr) const
 {
     auto bt = static_cast<PadConfigAnalog>(curButton_);
-    printf("Wait for Analog '%s'\n", toString(bt));
+    LOG(("Wait for Analog '%s'\n", toString(bt)));
 
     if (mgr.printCnfAnalogFunc_)
     {
@@ -10,13 +10,14 @@
 #include <vector>
 #include <optional>
 #include <array>
+#include <algorithm>
 #include "pad_translator.h"
 #include "pad_state.h"
 #include "rot_encoder.h"
 #include "serializer.h"
 #include "app_config.h"
 #include <functional>
-#include <memory>
+#include <variant>
 
 class PadManager
 {
@@ -27,6 +28,8 @@ public:
     static constexpr int N_PORTS = 5;
     static constexpr int N_OUTPUT_PORTS = 4;
     static constexpr int N_ENCODER_PORTS = 2;
+    // 展開しておく設定の数. ポートごとに 2P混在モードの分も
+    static constexpr int N_CACHED_CONFIGS = N_PORTS * 2;
 
     enum class StateKind
     {
@@ -47,6 +50,7 @@ public:
         std::array<uint32_t, N_BUTTONS / 32> buttons;
         int hat;
         std::array<int, N_ANALOGS> analogs;
+        std::array<int, N_ANALOGS> relatives; // 相対軸の移動量
 
         bool getButton(int i) const { return (buttons[i >> 5] & (1u << (i & 31))); }
 
@@ -56,6 +60,7 @@ public:
             buttons = {};
             hat = -1;
             analogs = {128, 128, 128, 0, 0, 128, 0, 0, 0};
+            relatives = {};
         }
     };
 
@@ -77,10 +82,22 @@ public:
         return inst;
     }
 
+    // 接続, 切断時に呼ぶ. エンコーダは次のレポートを原点にし直す
     void resetLatestPadData(int port)
     {
         latestPadData_[port].reset();
+        if (port < N_OUTPUT_PORTS)
+        {
+            for (auto &re : rotEncoders_[port])
+            {
+                re.reset();
+            }
+        }
     }
+    // 接続時に設定を展開しておく. レポートの処理ではヒープを使わない
+    void preloadConfig(int vid, int pid);
+    // 切断時に呼ぶ. 同じ機器が他に繋がっていなければ展開した設定を捨てる
+    void releaseConfig(int vid, int pid);
 
     uint32_t getButtons(int port) const;
     uint32_t getNonRapidButtons(int port) const;
@@ -93,11 +110,14 @@ public:
     void setRapidFirePhaseMask(uint32_t v);
 
     const PadState::AnalogState &getAnalogState(int port) const;
+    // 出力ポートの状態がレポートで更新された回数. 新しいレポートが来たかを見るのに使う
+    uint32_t getReportCount(int port) const;
 
     void setVSyncCount(int count);
 
     void serialize(Serializer &s) const;
     void deserialize(Deserializer &s);
+    void onConfigStored(const uint8_t *image, size_t size);
 
     void enterNormalMode();
     void enterConfigMode();
@@ -143,12 +163,10 @@ public:
     {
         translator_.reset();
     }
-    void setRotEncSetting(int kind, int axis, int scale);
+    void setRotEncSetting(int kind, int axis, int scale, RotEncoder::Mode mode);
+    RotEncoder &getRotEncoder(int port, int kind) { return rotEncoders_[port][kind]; }
 
-    void setTwinPortMode(bool f)
-    {
-        twinPortMode_ = f;
-    }
+    void setTwinPortMode(bool f);
 
     void setAnalogMode(AppConfig::AnalogMode mode)
     {
@@ -226,7 +244,11 @@ protected:
         bool anyButtonOn_ = false;
         uint32_t idleCycle_ = 0;
 
-        std::vector<ButtonSet> buttonSets_;
+        // 設定中に確保しないように最大数分持っておく
+        static constexpr int MAX_BUTTON_SETS = std::max(static_cast<int>(PadStateButton::MAX_2P),
+                                                        N_PAD_CONFIG_ANALOGS);
+        std::array<ButtonSet, MAX_BUTTON_SETS> buttonSets_;
+        int nButtonSets_ = 0;
 
     public:
         void init(PadManager &mgr) override;
@@ -269,10 +291,13 @@ protected:
 
 private:
     std::array<PadInput, N_PORTS> latestPadData_;
+    std::array<uint32_t, N_OUTPUT_PORTS> reportCounts_{};
     std::array<PadState, N_PORTS> padStates_;
     RotEncoder rotEncoders_[N_OUTPUT_PORTS][2];
 
-    std::unique_ptr<ModeHandler> modeHandler_;
+    // モードの切り替えでヒープを使わないようにその場で作る
+    std::variant<std::monostate, ButtonConfigMode, AnalogConfigMode> modeStorage_;
+    ModeHandler *modeHandler_ = nullptr;
 
     bool enableModeChangeByButton_ = true;
     bool enableLED_ = true;
@@ -282,6 +307,15 @@ private:
     bool twinPortMode_ = false;
     AppConfig::AnalogMode analogMode_{};
 
+    // preloadConfig() した機器と接続数
+    struct MountedDevice
+    {
+        int vid;
+        int pid;
+        int count = 0;
+    };
+    std::array<MountedDevice, N_PORTS> mountedDevices_{};
+
     PadTranslator translator_;
 
     PrintButtonFunc printButtonFunc_;
@@ -181,10 +181,7 @@ bool PadState::set(const PadTranslator &translator,
 
 void PadState::dump() const
 {
-    for (int i = 31; i >= 0; --i)
-    {
-        printf("%d", mappedButtons_ & (1 << i) ? 1 : 0);
-    }
-    printf(" : %d %d %d %d\n",
-           analog_.values[0], analog_.values[1], analog_.values[2], analog_.values[3]);
+    // 1bit ずつ出すとログが溢れるので16進で
+    LOG(("%08x : %d %d %d %d\n", mappedButtons_,
+         analog_.values[0], analog_.values[1], analog_.values[2], analog_.values[3]));
 }
@@ -9,6 +9,8 @@
 #include <cstdio>
 #include "serializer.h"
 #include "debug.h"
+#include "mem_stat.h"
+#include "util.h"
 
 int getLevel(PadConfig::AnalogPos p)
 {
@@ -177,76 +179,227 @@ void PadConfig::dump() const
     }
 }
 
-void PadConfig::serialize(Serializer &s) const
+namespace
 {
-    s.append16u(vid_);
-    s.append16u(pid_);
-    s.append8u(outPortOfs_);
-
-    auto writeUnit = [&](const Unit &v)
-    {
-        s.append8u(static_cast<uint8_t>(v.type));
-        s.append8u(v.number);
-        s.append8u(static_cast<uint8_t>(v.analogOn));
-        s.append8u(static_cast<uint8_t>(v.analogOff));
-        s.append8u(static_cast<uint8_t>(v.hatPos));
-        s.append8u(v.index);
-        s.append8u(v.subIndex);
-        s.append8u(v.inPortOfs);
-    };
+    // ver2 の Unit
+    //   先頭 1byte: type(2bit) | subIndex あり(1bit) | inPortOfs あり(1bit) | index(4bit)
+    //   index が 15 以上なら続けて varint
+    //   type 毎に BUTTON: number, ANALOG: number<<4 | on<<2 | off, HAT: number<<3 | hatPos (varint)
+    //   subIndex は同じ index が続いた数と違うときだけ書く
+    constexpr int UNIT_SUB_INDEX = 1 << 2;
+    constexpr int UNIT_IN_PORT_OFS = 1 << 3;
+    constexpr int UNIT_INDEX_SHIFT = 4;
+    constexpr int UNIT_INDEX_ESCAPE = 15;
+
+    // 直前の Unit から決まる subIndex
+    int getImplicitSubIndex(const PadConfig::Unit *prev, int index)
+    {
+        return prev && prev->index == index ? prev->subIndex + 1 : 0;
+    }
 
-    s.append16u(buttons_.size());
-    for (auto &v : buttons_)
+    void writeUnit(Serializer &s, const PadConfig::Unit &v, const PadConfig::Unit *prev)
     {
-        writeUnit(v);
+        using Type = PadConfig::Type;
+
+        bool sub = v.subIndex != getImplicitSubIndex(prev, v.index);
+        int index = std::min<int>(v.index, UNIT_INDEX_ESCAPE);
+        s.append8u(static_cast<int>(v.type) |
+                   (sub ? UNIT_SUB_INDEX : 0) |
+                   (v.inPortOfs ? UNIT_IN_PORT_OFS : 0) |
+                   (index << UNIT_INDEX_SHIFT));
+        if (index == UNIT_INDEX_ESCAPE)
+        {
+            s.appendVarint(v.index);
+        }
+
+        switch (v.type)
+        {
+        case Type::BUTTON:
+            s.appendVarint(v.number);
+            break;
+
+        case Type::ANALOG:
+            s.appendVarint((v.number << 4) |
+                           (static_cast<int>(v.analogOn) << 2) |
+                           static_cast<int>(v.analogOff));
+            break;
+
+        case Type::HAT:
+            s.appendVarint((v.number << 3) | static_cast<int>(v.hatPos));
+            break;
+
+        default:
+            break;
+        }
+
+        if (sub)
+        {
+            s.appendVarint(v.subIndex);
+        }
+        if (v.inPortOfs)
+        {
+            s.appendVarint(v.inPortOfs);
+        }
     }
 
-    s.append8u(analogs_.size());
-    for (auto &v : analogs_)
+    PadConfig::Unit readUnit(Deserializer &s, const PadConfig::Unit *prev)
     {
-        writeUnit(v);
+        using Type = PadConfig::Type;
+        using AnalogPos = PadConfig::AnalogPos;
+
+        PadConfig::Unit v;
+        int head = s.peek8u();
+        v.type = static_cast<Type>(head & 3);
+        v.index = head >> UNIT_INDEX_SHIFT;
+        if (v.index == UNIT_INDEX_ESCAPE)
+        {
+            v.index = s.peekVarint();
+        }
+
+        switch (v.type)
+        {
+        case Type::BUTTON:
+            v.number = s.peekVarint();
+            break;
+
+        case Type::ANALOG:
+        {
+            auto x = s.peekVarint();
+            v.number = x >> 4;
+            v.analogOn = static_cast<AnalogPos>((x >> 2) & 3);
+            v.analogOff = static_cast<AnalogPos>(x & 3);
+        }
+        break;
+
+        case Type::HAT:
+        {
+            auto x = s.peekVarint();
+            v.number = x >> 3;
+            v.hatPos = static_cast<PadConfig::HatPos>(x & 7);
+        }
+        break;
+
+        default:
+            break;
+        }
+
+        v.subIndex = head & UNIT_SUB_INDEX ? s.peekVarint() : getImplicitSubIndex(prev, v.index);
+        v.inPortOfs = head & UNIT_IN_PORT_OFS ? s.peekVarint() : 0;
+        return v;
     }
-}
 
-PadConfig::PadConfig(Deserializer &s)
-{
-    vid_ = s.peek16u();
-    pid_ = s.peek16u();
-    outPortOfs_ = s.peek8u();
+    // 通過した内容の CRC を求める
+    struct CRCSink : public Serializer::Sink
+    {
+        uint32_t crc = 0;
+        void write(const uint8_t *p, size_t size) override { crc = util::crc32(crc, p, size); }
+    };
 
-    auto readUnit = [&]()
+    // ver1 の Unit. 8byte 固定
+    PadConfig::Unit readUnitV1(Deserializer &s)
     {
-        Unit v;
+        using Type = PadConfig::Type;
+        using AnalogPos = PadConfig::AnalogPos;
+
+        PadConfig::Unit v;
         v.type = static_cast<Type>(s.peek8u());
         v.number = s.peek8u();
         v.analogOn = static_cast<AnalogPos>(s.peek8u());
         v.analogOff = static_cast<AnalogPos>(s.peek8u());
-        v.hatPos = static_cast<HatPos>(s.peek8u());
+        v.hatPos = static_cast<PadConfig::HatPos>(s.peek8u());
         v.index = s.peek8u();
         v.subIndex = s.peek8u();
         v.inPortOfs = s.peek8u();
         return v;
-    };
+    }
 
-    auto n = s.peek16u();
-    buttons_.reserve(n);
-    for (auto i = 0u; i < n; ++i)
+    // 展開せずに読み飛ばす
+    PadConfig::DeviceID skipConfig(Deserializer &s, int version)
     {
-        buttons_.push_back(readUnit());
+        int vid = s.peek16u();
+        int pid = s.peek16u();
+        if (version < 2)
+        {
+            int outPortOfs = s.peek8u();
+            s.skip(s.peek16u() * 8);
+            s.skip(s.peek8u() * 8);
+            return {vid, pid, outPortOfs};
+        }
+
+        size_t n = s.peekVarint();
+        auto x = s.peekVarint();
+        n += x >> 2;
+        for (size_t i = 0; i < n && !s.hasError(); ++i)
+        {
+            readUnit(s, nullptr);
+        }
+        return {vid, pid, x & 3};
     }
+}
 
-    n = s.peek8u();
-    analogs_.reserve(n);
-    for (auto i = 0u; i < n; ++i)
+// ver2
+//   vid(16), pid(16), ボタン数 (varint), アナログ数 << 2 | outPortOfs (varint), Unit...
+void PadConfig::serialize(Serializer &s) const
+{
+    s.append16u(vid_);
+    s.append16u(pid_);
+    s.appendVarint(buttons_.size());
+    s.appendVarint((analogs_.size() << 2) | outPortOfs_);
+
+    for (auto *units : {&buttons_, &analogs_})
+    {
+        const Unit *prev = nullptr;
+        for (auto &v : *units)
+        {
+            writeUnit(s, v, prev);
+            prev = &v;
+        }
+    }
+}
+
+PadConfig::PadConfig(Deserializer &s, int version)
+{
+    vid_ = s.peek16u();
+    pid_ = s.peek16u();
+
+    size_t nButtons = 0, nAnalogs = 0;
+    if (version < 2)
+    {
+        outPortOfs_ = s.peek8u();
+        nButtons = s.peek16u();
+    }
+    else
+    {
+        nButtons = s.peekVarint();
+        auto x = s.peekVarint();
+        nAnalogs = x >> 2;
+        outPortOfs_ = x & 3;
+    }
+
+    // 壊れたデータで大きな領域を確保しないように, 残りのバイト数で制限する
+    // Unit は最低 1byte
+    auto readUnits = [&](std::vector<Unit> &units, size_t n)
+    {
+        units.reserve(std::min(n, s.getRemaining()));
+        for (size_t i = 0; i < n && !s.hasError(); ++i)
+        {
+            units.push_back(version < 2 ? readUnitV1(s) : readUnit(s, units.empty() ? nullptr : &units.back()));
+        }
+    };
+
+    readUnits(buttons_, nButtons);
+    if (version < 2)
     {
-        analogs_.push_back(readUnit());
+        nAnalogs = s.peek8u();
     }
+    readUnits(analogs_, nAnalogs);
 }
 
 /////////
 /////////
 
-PadTranslator::PadTranslator()
+PadTranslator::PadTranslator(int cacheSize)
+    : cache_(cacheSize)
 {
     /*
         // default pad configs
@@ -299,39 +452,118 @@ PadTranslator::PadTranslator()
 
 void PadTranslator::reset()
 {
-    configs_.clear();
+    store_ = nullptr;
+    index_.clear();
+    overlay_.clear();
+    for (auto &c : cache_)
+    {
+        c = {};
+    }
 }
 
-PadConfig *PadTranslator::_find(int vid, int pid, int portOfs)
+PadConfig *PadTranslator::findOverlay(const PadConfig::DeviceID &id)
 {
-    PadConfig::DeviceID id{vid, pid, portOfs};
-    auto p = std::partition_point(configs_.begin(), configs_.end(),
+    auto p = std::partition_point(overlay_.begin(), overlay_.end(),
                                   [&](const PadConfig &v)
                                   { return v.getDeviceID() < id; });
-    if (p != configs_.end() && p->getDeviceID() == id)
+    if (p != overlay_.end() && p->getDeviceID() == id)
     {
         return &*p;
     }
     return nullptr;
 }
 
+const PadTranslator::StoredConfig *
+PadTranslator::findStored(const PadConfig::DeviceID &id) const
+{
+    auto p = std::partition_point(index_.begin(), index_.end(),
+                                  [&](const StoredConfig &v)
+                                  { return v.id < id; });
+    if (p != index_.end() && p->id == id)
+    {
+        return &*p;
+    }
+    return nullptr;
+}
+
+// 保存領域から展開する. 展開済みならそれを使い, 無ければ一番古いものと入れ替える
+const PadConfig &PadTranslator::loadStored(const StoredConfig &sc) const
+{
+    ++cacheClock_;
+    CacheEntry *victim = &cache_[0];
+    for (auto &c : cache_)
+    {
+        if (c.valid && c.config.getDeviceID() == sc.id)
+        {
+            c.lastUse = cacheClock_;
+            return c.config;
+        }
+        if (!c.valid || (victim->valid && c.lastUse < victim->lastUse))
+        {
+            victim = &c;
+        }
+    }
+
+    Deserializer s(store_ + sc.ofs, sc.size);
+    victim->config = PadConfig(s, storeVer_);
+    victim->lastUse = cacheClock_;
+    victim->valid = true;
+    return victim->config;
+}
+
+void PadTranslator::invalidateCache(const PadConfig::DeviceID &id)
+{
+    for (auto &c : cache_)
+    {
+        if (c.valid && c.config.getDeviceID() == id)
+        {
+            c = {};
+        }
+    }
+}
+
 const PadConfig *PadTranslator::find(int vid, int pid, int portOfs) const
 {
-    auto p = const_cast<PadTranslator *>(this)->_find(vid, pid, portOfs);
-    return p ? p : &defaultConfig_;
+    PadConfig::DeviceID id{vid, pid, portOfs};
+    if (auto *p = const_cast<PadTranslator *>(this)->findOverlay(id))
+    {
+        return p;
+    }
+    if (auto *sc = findStored(id))
+    {
+        return &loadStored(*sc);
+    }
+    return &defaultConfig_;
 }
 
-void PadTranslator::sort()
+// id 順の位置に入れる
+PadConfig *PadTranslator::insertOverlay(PadConfig &&cnf)
 {
-    std::sort(configs_.begin(), configs_.end(), [&](auto &a, auto &b)
-              { return a.getDeviceID() < b.getDeviceID(); });
+    auto id = cnf.getDeviceID();
+    auto p = std::partition_point(overlay_.begin(), overlay_.end(),
+                                  [&](const PadConfig &v)
+                                  { return v.getDeviceID() < id; });
+    return &*overlay_.insert(p, std::move(cnf));
 }
 
 void PadTranslator::append(PadConfig &&cnf, bool buttons, bool analogs)
 {
+    MEMSTAT_SCOPE(TRANSLATOR);
     cnf.dump();
 
-    if (auto *p = _find(cnf.getVID(), cnf.getPID(), cnf.getOutPortOfs()))
+    auto id = cnf.getDeviceID();
+    auto *p = findOverlay(id);
+    if (!p)
+    {
+        if (auto *sc = findStored(id))
+        {
+            // 一部だけ置き換えるときのために保存されている内容を持ってくる
+            p = insertOverlay(PadConfig(loadStored(*sc)));
+            invalidateCache(id);
+        }
+    }
+
+    if (p)
     {
         DPRINT(("replace config %04x, %04x, %d\n", cnf.getVID(), cnf.getPID(), cnf.getOutPortOfs()));
         if (buttons && analogs)
@@ -350,44 +582,233 @@ void PadTranslator::append(PadConfig &&cnf, bool buttons, bool analogs)
     else
     {
         DPRINT(("new config %04x, %04x, %d\n", cnf.getVID(), cnf.getPID(), cnf.getOutPortOfs()));
-        configs_.push_back(std::move(cnf));
-        sort();
+        insertOverlay(std::move(cnf));
     }
 }
 
-void PadTranslator::serialize(Serializer &s) const
+// 保存済みのものは展開せずにそのままコピーし, overlay_ と id 順に混ぜる
+// 書いた数を返す
+int PadTranslator::serializeConfigs(Serializer &s) const
 {
-    s.append(configs_.size());
-
     int n = 0;
-    for (auto &v : configs_)
+    auto ov = overlay_.begin();
+    auto st = index_.begin();
+    while (ov != overlay_.end() || st != index_.end())
     {
         if (s.exceedLimit())
         {
-            s.append8u(0);
+            break;
+        }
+
+        if (st == index_.end() ||
+            (ov != overlay_.end() && ov->getDeviceID() <= st->id))
+        {
+            if (st != index_.end() && ov->getDeviceID() == st->id)
+            {
+                ++st;
+            }
+            (ov++)->serialize(s);
+        }
+        else
+        {
+            if (storeVer_ == PadConfig::CUR_VER)
+            {
+                s.append(store_ + st->ofs, st->size);
+            }
+            else
+            {
+                // 古い形式は展開して書き直す
+                Deserializer d(store_ + st->ofs, st->size);
+                PadConfig(d, storeVer_).serialize(s);
+            }
+            ++st;
         }
-        s.append8u(1); // enabled
-        v.serialize(s);
         ++n;
     }
-    DPRINT(("store %d/%d configs.\n", n, configs_.size()));
+    return n;
+}
+
+void PadTranslator::serialize(Serializer &s) const
+{
+    storeOfsInImage_ = s.getSize();
+    s.append32u(MAGIC);
+    s.append8u(PadConfig::CUR_VER);
+
+    // 個数, サイズ, CRC を先に書くので, 一度出力して数える
+    constexpr size_t HEADER_SIZE = 4 * 3;
+    CRCSink crc;
+    auto top = s.getSize() + HEADER_SIZE;
+    Serializer m(&crc, s.getLimitSize(), top);
+    int n = serializeConfigs(m);
+    m.flush();
+    auto size = m.getSize() - top;
+
+    s.append32u(n);
+    s.append32u(size);
+    s.append32u(crc.crc);
+    serializeConfigs(s);
+    DPRINT(("store %d configs, %d bytes.\n", n, size));
+}
+
+// 各設定の位置だけを調べる. 中身は使うときに展開する
+// 壊れていたら何も読まない
+void PadTranslator::buildIndex(Deserializer &s)
+{
+    index_.clear();
+    for (auto &c : cache_)
+    {
+        c = {};
+    }
+    store_ = nullptr;
+
+    auto *top = s.getPointer();
+    uint32_t head = s.peek32u();
+    if (s.hasError())
+    {
+        return;
+    }
+
+    size_t nn;
+    if (head == MAGIC)
+    {
+        storeVer_ = s.peek8u();
+        nn = s.peek32u();
+        size_t size = s.peek32u();
+        uint32_t crc = s.peek32u();
+        if (s.hasError() || storeVer_ < 2 || storeVer_ > PadConfig::CUR_VER)
+        {
+            DPRINT(("pad config: unknown format %d\n", storeVer_));
+            return;
+        }
+        auto *p = s.getPointer();
+        if (!s.skip(size) || util::crc32(0, p, size) != crc)
+        {
+            DPRINT(("pad config: CRC error\n"));
+            return;
+        }
+        top = p;
+    }
+    else
+    {
+        // ver1. 先頭は個数
+        storeVer_ = 1;
+        nn = head;
+    }
+
+    DPRINT(("%d configs (ver%d)...\n", nn, storeVer_));
+
+    // ver2 はサイズが分かっているので, その中だけを読む
+    Deserializer body(storeVer_ >= 2 ? top : s.getPointer(),
+                      storeVer_ >= 2 ? s.getPointer() - top : s.getRemaining());
+    index_.reserve(std::min(nn, body.getRemaining()));
+    while (index_.size() < nn)
+    {
+        if (storeVer_ < 2 && !body.peek8u())
+        {
+            break;
+        }
+
+        auto *p = body.getPointer();
+        auto id = skipConfig(body, storeVer_);
+        if (body.hasError())
+        {
+            DPRINT(("pad config: broken entry %d\n", index_.size()));
+            break;
+        }
+        index_.push_back({id,
+                          static_cast<uint32_t>(p - top),
+                          static_cast<uint32_t>(body.getPointer() - p)});
+    }
+    if (storeVer_ >= 2 && (index_.size() != nn || body.getRemaining()))
+    {
+        // 個数は CRC の外なので中身と合わせて確かめる
+        DPRINT(("pad config: count mismatch %d/%d\n", index_.size(), nn));
+        index_.clear();
+        return;
+    }
+    store_ = top;
+
+    if (storeVer_ < 2)
+    {
+        // 続きを読めるように進めておく
+        s.skip(body.getPointer() - s.getPointer());
+    }
+
+    DPRINT(("load %d/%d configs.\n", index_.size(), nn));
+    std::sort(index_.begin(), index_.end(), [](auto &a, auto &b)
+              { return a.id < b.id; });
 }
 
 void PadTranslator::deserialize(Deserializer &s)
 {
-    configs_.clear();
-    auto nn = s.peek();
+    MEMSTAT_SCOPE(TRANSLATOR);
+    overlay_.clear();
+    buildIndex(s);
+}
 
-    DPRINT(("%d configs...\n", nn));
+// 保存した内容は overlay_ の分も含むので, 保存できたものは overlay_ から外す
+void PadTranslator::rebind(const uint8_t *image, size_t size)
+{
+    MEMSTAT_SCOPE(TRANSLATOR);
+    if (size < storeOfsInImage_)
+    {
+        return;
+    }
 
-    int n = 0;
-    while (n < nn && s.peek8u())
+    // overlay_ から外れるものと展開済みだったものは展開しなおしておく
+    // 次のレポートの処理で確保しないように
+    // overlay_ のものは今編集している機器なので, 入りきらないときはこちらを優先する
+    std::vector<PadConfig::DeviceID> cached;
+    cached.reserve(cache_.size());
+    for (auto &c : cache_)
     {
-        PadConfig cnf(s);
-        configs_.push_back(std::move(cnf));
-        ++n;
+        if (c.valid)
+        {
+            cached.push_back(c.config.getDeviceID());
+        }
+    }
+
+    Deserializer s(image + storeOfsInImage_, size - storeOfsInImage_);
+    buildIndex(s);
+
+    std::vector<PadConfig::DeviceID> reload;
+    reload.reserve(cache_.size());
+    for (auto &v : overlay_)
+    {
+        if (reload.size() < cache_.size() && findStored(v.getDeviceID()))
+        {
+            reload.push_back(v.getDeviceID());
+        }
+    }
+    for (auto &id : cached)
+    {
+        if (reload.size() < cache_.size() &&
+            std::find(reload.begin(), reload.end(), id) == reload.end())
+        {
+            reload.push_back(id);
+        }
     }
 
-    DPRINT(("load %d/%d configs.\n", n, nn));
-    sort();
+    overlay_.erase(std::remove_if(overlay_.begin(), overlay_.end(),
+                                  [&](const PadConfig &v)
+                                  { return findStored(v.getDeviceID()); }),
+                   overlay_.end());
+
+    for (auto &id : reload)
+    {
+        auto [vid, pid, portOfs] = id;
+        find(vid, pid, portOfs);
+    }
+}
+
+void PadTranslator::dropCache(int vid, int pid)
+{
+    for (auto &c : cache_)
+    {
+        auto [cvid, cpid, portOfs] = c.config.getDeviceID();
+        if (c.valid && cvid == vid && cpid == pid)
+        {
+            c = {};
+        }
+    }
 }
@@ -6,6 +6,7 @@
 
 #include <cstdint>
 #include <vector>
+#include <array>
 #include <tuple>
 #include <optional>
 
@@ -91,11 +92,16 @@ public:
 
     using DeviceID = std::tuple<uint16_t, uint16_t, uint8_t>;
 
+    // 保存形式
+    //   1: Unit は 8byte 固定
+    //   2: Unit は使うフィールドだけを詰めて書く
+    inline static constexpr int CUR_VER = 2;
+
 public:
     PadConfig() = default;
     PadConfig(int vid, int pid, int outPortOfs,
               const std::vector<Unit> &buttons, const std::vector<Unit> &analogs);
-    PadConfig(Deserializer &s);
+    PadConfig(Deserializer &s, int version = CUR_VER);
 
     bool convertButton(int i, const uint32_t *buttons, int nButtons, const int *analogs, int nAnalogs, int hat) const;
     std::optional<int> convertAnalog(int i, const uint32_t *buttons, int nButtons, const int *analogs, int nAnalogs, int hat) const;
@@ -134,25 +140,68 @@ bool testHat(int hat, PadConfig::HatPos hatPos);
 PadConfig::AnalogPos getAnalogPos(int v);
 
 // デバイスIDと対応する設定を管理
+// 保存された設定は保存領域を直接参照し, 使うものだけを展開する
 class PadTranslator
 {
-    std::vector<PadConfig> configs_;
+    // 保存領域上の設定の位置
+    struct StoredConfig
+    {
+        PadConfig::DeviceID id;
+        uint32_t ofs;  // store_ から
+        uint32_t size; // シリアライズされたバイト数
+    };
+
+    // 保存形式
+    //   ver1: 個数 (s32), { 有効 (u8), PadConfig } の繰り返し. 有効が 0 なら終わり
+    //   ver2: MAGIC (u32), CUR_VER (u8), 個数 (u32), サイズ (u32), CRC32 (u32), PadConfig の並び
+    inline static constexpr uint32_t MAGIC = 'E' | ('A' << 8) | ('P' << 16) | ('C' << 24);
+
+    const uint8_t *store_ = nullptr;
+    int storeVer_ = PadConfig::CUR_VER;
+    std::vector<StoredConfig> index_; // id でソート
+    mutable uint32_t storeOfsInImage_ = 0; // 保存時の設定全体の中での位置
+
+    // 今回追加, 変更した設定. index_ より優先する
+    std::vector<PadConfig> overlay_; // id でソート
+
+    // 保存領域から展開した設定. 数はコンストラクタで決める
+    struct CacheEntry
+    {
+        PadConfig config;
+        uint32_t lastUse = 0;
+        bool valid = false;
+    };
+    mutable std::vector<CacheEntry> cache_;
+    mutable uint32_t cacheClock_ = 0;
+
     PadConfig defaultConfig_;
 
 public:
-    PadTranslator();
+    // cacheSize は同時に使う設定の数. 接続中の機器の分が全部入ること
+    explicit PadTranslator(int cacheSize);
 
     void setDefaultConfig(PadConfig &&cnf) { defaultConfig_ = std::move(cnf); }
     void append(PadConfig &&cnf, bool buttons, bool analogs);
+    // 戻り値は次の find(), append() まで有効
     const PadConfig *find(int vid, int pid, int portOfs = 0) const;
 
     void serialize(Serializer &s) const;
+    // s の領域は rebind() するまで参照し続ける
     void deserialize(Deserializer &s);
+    // 保存が終わったら, 保存した内容 (設定全体) を参照しなおす
+    void rebind(const uint8_t *image, size_t size);
+    // 機器を外したので展開した設定を捨てる (portOfs 全部)
+    void dropCache(int vid, int pid);
 
     void reset();
 
 protected:
-    PadConfig *_find(int vid, int pid, int portOfs = 0);
-
-    void sort();
+    PadConfig *findOverlay(const PadConfig::DeviceID &id);
+    const StoredConfig *findStored(const PadConfig::DeviceID &id) const;
+    const PadConfig &loadStored(const StoredConfig &sc) const;
+    void invalidateCache(const PadConfig::DeviceID &id);
+
+    int serializeConfigs(Serializer &s) const;
+    void buildIndex(Deserializer &s);
+    PadConfig *insertOverlay(PadConfig &&cnf);
 };
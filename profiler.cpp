@@ -0,0 +1,105 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 16:05:12
+ */
+
+#include "profiler.h"
+
+#ifdef ENABLE_PROFILER
+
+#include <stdio.h>
+#include <hardware/clocks.h>
+#include "debug.h"
+
+namespace profiler
+{
+    namespace
+    {
+        StageStats stats_[N_STAGE];
+
+        const char *stageNames_[N_STAGE] = {
+            "loop",
+            "button",
+            "menu",
+            "pad",
+            "output",
+            "display",
+            "textscr",
+            "usb",
+            "midi",
+            "save",
+        };
+    }
+
+    void add(Stage s, uint32_t cycles, uint32_t us)
+    {
+        // SysTick が1周する時間. us は 1us 未満を切り捨てているので 1 手前から1周したとみなす
+        static const uint32_t wrapUs = (1u << 24) / (clock_get_hz(clk_sys) / 1000000);
+
+        auto &st = stats_[static_cast<int>(s)];
+        if (us + 1 >= wrapUs)
+        {
+            ++st.overflows;
+            return;
+        }
+        st.add(cycles);
+    }
+
+    const StageStats &getStats(Stage s)
+    {
+        return stats_[static_cast<int>(s)];
+    }
+
+    const char *getStageName(Stage s)
+    {
+        return stageNames_[static_cast<int>(s)];
+    }
+
+    void reset()
+    {
+        for (auto &s : stats_)
+        {
+            s = {};
+        }
+    }
+
+    void dump()
+    {
+        // 量が多いので溜まっているログを送ってから直接出す
+        LOG_FLUSH();
+        printf("stage      count      min      ave      max  overflow  hist(<2^%d, x2 each)\n", HIST_SHIFT);
+        for (int i = 0; i < N_STAGE; ++i)
+        {
+            const auto &s = stats_[i];
+            printf("%-8s %7u %8u %8u %8u %9u ",
+                   stageNames_[i], (unsigned)s.count,
+                   (unsigned)s.getMin(), (unsigned)s.getAve(), (unsigned)s.getMax(),
+                   (unsigned)s.overflows);
+            for (auto h : s.hist)
+            {
+                printf(" %u", (unsigned)h);
+            }
+            printf("\n");
+        }
+
+        // 出力の待ちで loop の max が跳ねるので取り直す
+        reset();
+    }
+
+    void handleRequest(int c)
+    {
+        switch (c)
+        {
+        case 'p':
+            dump();
+            break;
+
+        case 'r':
+            reset();
+            LOG(("profiler reset\n"));
+            break;
+        }
+    }
+}
+
+#endif
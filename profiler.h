@@ -0,0 +1,92 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 16:05:12
+ */
+#pragma once
+
+// main loop の処理段ごとのサイクル数を取る
+// ENABLE_PROFILER が無ければマクロは空になり何も残らない
+
+#ifdef ENABLE_PROFILER
+
+#include "util.h"
+#include <stdint.h>
+#include <pico/time.h>
+
+namespace profiler
+{
+    enum class Stage
+    {
+        LOOP, // 1周全体
+        BUTTON,
+        MENU,
+        PAD,
+        OUTPUT,
+        DISPLAY,
+        TEXT_SCREEN,
+        USB,
+        MIDI,
+        SAVE,
+        MAX,
+    };
+    inline constexpr int N_STAGE = static_cast<int>(Stage::MAX);
+
+    // 2^(i + HIST_SHIFT) サイクル未満を i 番目に数える. 最後は残り全部
+    inline constexpr int N_HIST = 16;
+    inline constexpr int HIST_SHIFT = 8;
+
+    // SysTick は 24bit なので 2^24 サイクル (125MHz で約 134ms) 以上かかった回は測れない
+    // その回は統計に入れず overflows に数える
+    struct StageStats : util::CycleStats
+    {
+        uint32_t hist[N_HIST]{};
+        uint32_t overflows = 0;
+
+        void add(uint32_t c)
+        {
+            util::CycleStats::add(c);
+            int i = c >> HIST_SHIFT ? 32 - HIST_SHIFT - __builtin_clz(c) : 0;
+            ++hist[i < N_HIST ? i : N_HIST - 1];
+        }
+    };
+
+    // us は time_us_32() で測った時間. SysTick が1周したかを見るのに使う
+    void add(Stage s, uint32_t cycles, uint32_t us);
+    const StageStats &getStats(Stage s);
+    const char *getStageName(Stage s);
+    void reset();
+
+    // UART に全段の統計を出してリセットする
+    void dump();
+    // UART からの要求. 'p' で dump, 'r' で reset
+    void handleRequest(int c);
+
+    struct Clock
+    {
+        uint32_t clk;
+        uint32_t us;
+    };
+
+    inline Clock begin() { return {util::getSysTickCounter24(), time_us_32()}; }
+    inline void end(Stage s, const Clock &c)
+    {
+        auto clk = util::getSysTickCounter24();
+        add(s, (c.clk - clk) & 0xffffff, time_us_32() - c.us);
+    }
+}
+
+#define PROFILE_BEGIN(stage) const profiler::Clock profileClk_##stage = profiler::begin()
+#define PROFILE_END(stage) profiler::end(profiler::Stage::stage, profileClk_##stage)
+
+#else
+
+#define PROFILE_BEGIN(stage) \
+    do                       \
+    {                        \
+    } while (0)
+#define PROFILE_END(stage) \
+    do                     \
+    {                      \
+    } while (0)
+
+#endif
@@ -0,0 +1,141 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 12:52:03
+ */
+
+#include "pwm_dac.h"
+#include <hardware/dma.h>
+#include <hardware/pwm.h>
+#include <hardware/irq.h>
+#include <algorithm>
+
+namespace
+{
+    // 122kHz で約 9.7 時間. 終わったら IRQ で再開する
+    constexpr uint32_t TRANSFER_COUNT = 0xffffffff;
+
+    uint32_t dmaChMask_ = 0;
+
+    void __isr dmaIRQHandler()
+    {
+        uint32_t ints = dma_hw->ints1 & dmaChMask_;
+        dma_hw->ints1 = ints;
+        for (int ch = 0; ints; ++ch, ints >>= 1)
+        {
+            if (ints & 1)
+            {
+                dma_channel_set_trans_count(ch, TRANSFER_COUNT, true);
+            }
+        }
+    }
+}
+
+void PWMDAC::start(const int *pins, int n)
+{
+    stop();
+
+    n = std::min(n, MAX_PINS);
+    for (int i = 0; i < n; ++i)
+    {
+        int slice = pwm_gpio_to_slice_num(pins[i]);
+        int idx = 0;
+        while (idx < nSlices_ && slices_[idx].slice != slice)
+        {
+            ++idx;
+        }
+        if (idx == nSlices_)
+        {
+            slices_[nSlices_++].slice = slice;
+        }
+        pins_[i] = {pins[i], idx, static_cast<int>(pwm_gpio_to_channel(pins[i]))};
+    }
+    nPins_ = n;
+
+    static bool irqInitialized = false;
+    if (!irqInitialized)
+    {
+        irq_set_exclusive_handler(DMA_IRQ_1, dmaIRQHandler);
+        irq_set_enabled(DMA_IRQ_1, true);
+        irqInitialized = true;
+    }
+
+    for (int i = 0; i < nSlices_; ++i)
+    {
+        auto &s = slices_[i];
+        auto &pat = patterns_[i];
+
+        // 今のレベルから始める
+        uint32_t cc = pwm_hw->slice[s.slice].cc;
+        for (auto &v : pat.cc)
+        {
+            v[0] = cc & 0xffff;
+            v[1] = cc >> 16;
+        }
+
+        if (s.dmaCh < 0)
+        {
+            s.dmaCh = dma_claim_unused_channel(true);
+        }
+
+        auto cfg = dma_channel_get_default_config(s.dmaCh);
+        channel_config_set_transfer_data_size(&cfg, DMA_SIZE_32);
+        channel_config_set_read_increment(&cfg, true);
+        channel_config_set_write_increment(&cfg, false);
+        channel_config_set_ring(&cfg, false /* read */, DITHER_BITS + 2);
+        channel_config_set_dreq(&cfg, DREQ_PWM_WRAP0 + s.slice);
+
+        dma_channel_configure(s.dmaCh, &cfg,
+                              &pwm_hw->slice[s.slice].cc,
+                              pat.cc,
+                              TRANSFER_COUNT,
+                              true);
+
+        dmaChMask_ |= 1u << s.dmaCh;
+        dma_channel_set_irq1_enabled(s.dmaCh, true);
+    }
+}
+
+void PWMDAC::stop()
+{
+    for (int i = 0; i < nSlices_; ++i)
+    {
+        auto &s = slices_[i];
+        dma_channel_set_irq1_enabled(s.dmaCh, false);
+        dma_channel_abort(s.dmaCh);
+        dmaChMask_ &= ~(1u << s.dmaCh);
+        dma_hw->ints1 = 1u << s.dmaCh;
+
+        // DMA チャンネルは次の start で使い回す
+        slices_[i].slice = -1;
+    }
+    nSlices_ = 0;
+    nPins_ = 0;
+}
+
+void PWMDAC::setLevel(int pin, int level)
+{
+    for (int i = 0; i < nPins_; ++i)
+    {
+        const auto &p = pins_[i];
+        if (p.pin != pin)
+        {
+            continue;
+        }
+
+        level = std::clamp(level, 0, LEVEL_MAX);
+
+        // 1 周期ずつ書き換わるので途中で DMA に読まれても問題ない
+        auto &cc = patterns_[p.sliceIdx].cc;
+        for (int k = 0; k < PATTERN_SIZE; ++k)
+        {
+            cc[k][p.ch] = getPatternLevel(level, k);
+        }
+        return;
+    }
+}
+
+PWMDAC &getPWMDAC()
+{
+    static PWMDAC inst;
+    return inst;
+}
@@ -0,0 +1,66 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 12:40:27
+ */
+
+#pragma once
+
+#include <cstdint>
+
+// PWM による DAC 出力
+// 16 周期分のレベルを DMA で毎周期書き換えて、10bit PWM で 14bit の分解能を得る
+class PWMDAC
+{
+public:
+    static constexpr int MAX_PINS = 4;
+    static constexpr int DITHER_BITS = 4;
+    static constexpr int LEVEL_MAX = 1024 << DITHER_BITS; // wrap = 1023 のとき
+    static constexpr int PATTERN_SIZE = 1 << DITHER_BITS;
+
+    // 下位ビットを期間中に散らすための順番 (ビット反転)
+    static constexpr uint8_t DITHER_ORDER[PATTERN_SIZE] = {0, 8, 4, 12, 2, 10, 6, 14, 1, 9, 5, 13, 3, 11, 7, 15};
+
+    // level を PATTERN_SIZE 周期に散らしたときの k 周期目の CC 値
+    static constexpr int getPatternLevel(int level, int k)
+    {
+        return (level >> DITHER_BITS) + (DITHER_ORDER[k] < (level & (PATTERN_SIZE - 1)) ? 1 : 0);
+    }
+
+    // pins は PWM の設定済みであること
+    void start(const int *pins, int n);
+    void stop();
+
+    // level: 0..LEVEL_MAX (1/16 カウント単位)
+    void setLevel(int pin, int level);
+
+    bool isRunning() const { return nSlices_; }
+
+private:
+    struct Slice
+    {
+        int slice = -1;
+        int dmaCh = -1;
+    };
+
+    struct Pin
+    {
+        int pin = -1;
+        int sliceIdx = 0;
+        int ch = 0; // 0: A, 1: B
+    };
+
+    // CC レジスタに書く値. [周期][A/B]
+    // DMA で ring 読みするため境界にそろえる
+    struct alignas(PATTERN_SIZE * 4) Pattern
+    {
+        uint16_t cc[PATTERN_SIZE][2];
+    };
+
+    Pattern patterns_[MAX_PINS];
+    Slice slices_[MAX_PINS];
+    Pin pins_[MAX_PINS];
+    int nSlices_ = 0;
+    int nPins_ = 0;
+};
+
+PWMDAC &getPWMDAC();
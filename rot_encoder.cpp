@@ -4,49 +4,86 @@
  */
 
 #include "rot_encoder.h"
-#include <math.h>
-#include "board.h"
-#include <stdio.h>
+#include <algorithm>
+#include <hardware/sync.h>
 
-void RotEncoder::update(int dclk, int velocity)
+void RotEncoder::setVelocity(int velocity)
 {
-    rct_ += dclk;
+    // ステップ/秒 -> tick あたりの位相増分
+    // 折り返しを検出できるよう 1 tick 1/2 ステップ未満に抑える
+    int64_t v = int64_t(velocity) * scale_;
+    int64_t inc = v * (int64_t(1) << 32) / TICK_HZ;
+    inc_ = static_cast<int32_t>(std::clamp<int64_t>(inc, -INT32_MAX, INT32_MAX));
+}
 
-    int v = velocity * scale_;
-    int ct_s = abs(v);
-    if (ct_s == 0)
+void RotEncoder::setMode(Mode mode)
+{
+    if (mode == mode_)
     {
         return;
     }
+    mode_ = mode;
+    reset();
+}
 
-    int clk_ct = CPU_CLOCK / ct_s;
+void RotEncoder::reset()
+{
+    // tick() が途中の値を見ないよう IRQ を止めてまとめて戻す
+    auto irq = save_and_disable_interrupts();
+    inc_ = 0;
+    hasPosition_ = false;
+    relFrac_ = 0;
+    target_ = relPos_;
+    restore_interrupts(irq);
+}
 
-    if (rct_ >= clk_ct)
+void RotEncoder::addRelative(int counts)
+{
+    queueCounts(counts, true);
+}
+
+void RotEncoder::setPosition(int pos)
+{
+    if (!hasPosition_)
     {
-        // rct_ -= clk_ct;
-        rct_ = 0;
-
-        if (v > 0)
-        {
-            ++state_;
-        }
-        else
-        {
-            --state_;
-        }
-        state_ &= 3;
+        // 最初の値を原点にする
+        hasPosition_ = true;
+        lastPosition_ = pos;
+        return;
     }
+
+    int d = pos - lastPosition_;
+    lastPosition_ = pos;
+    if (mode_ == Mode::POSITION_WRAP)
+    {
+        // 1回の更新で半周以上は回らないとみなす
+        d = ((d + 128) & 255) - 128;
+    }
+    queueCounts(d, false);
 }
 
-std::pair<bool, bool> RotEncoder::getEncState() const
+void RotEncoder::queueCounts(int counts, bool limit)
 {
-    static constexpr std::pair<bool, bool> table[] = {
-        {false, false},
-        {true, false},
-        {true, true},
-        {false, true},
-    };
-    return table[state_];
+    // 端数 (0..COUNT_SCALE_UNIT-1) は次回に持ち越す
+    // 切り捨ては常に負方向にして, 累計が位置の換算値と一致するようにする
+    int v = counts * scale_ + relFrac_;
+    int steps = v >= 0 ? v / COUNT_SCALE_UNIT : -((COUNT_SCALE_UNIT - 1 - v) / COUNT_SCALE_UNIT);
+    relFrac_ = v - steps * COUNT_SCALE_UNIT;
+    if (!steps)
+    {
+        return;
+    }
+
+    if (!limit)
+    {
+        target_ = target_ + steps;
+        return;
+    }
+
+    // 出しきれない程溜まった分は捨てる
+    int32_t backlog = target_ - relPos_;
+    int32_t t = std::clamp<int32_t>(backlog + steps, -MAX_BACKLOG, MAX_BACKLOG);
+    target_ = target_ + (t - backlog);
 }
 
 uint32_t RotEncoder::overrideButton(uint32_t buttons, int bitA, int bitB) const
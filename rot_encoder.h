@@ -10,23 +10,91 @@
 class RotEncoder
 {
 public:
-    void update(int dclk, int velocity);
+    enum class Mode
+    {
+        VELOCITY,      // 軸の傾きを回転速度にする
+        POSITION,      // 軸の位置に追従する
+        POSITION_WRAP, // 位置に追従. 端と端がつながっている (360度ダイヤル)
+    };
 
-    std::pair<bool, bool> getEncState() const;
+    // tick() を呼ぶ頻度. 1 tick に進むのは最大 1/2 ステップ
+    static constexpr int TICK_HZ = 10000;
+
+    // 相対入力と位置モードは scale がこの値のとき 1 カウント = 1 ステップ
+    static constexpr int COUNT_SCALE_UNIT = 50;
+    // 相対入力の未出力分の上限 (ステップ)
+    static constexpr int MAX_BACKLOG = TICK_HZ / 10;
+
+    // main loop から. velocity * scale [ステップ/秒] で回す
+    void setVelocity(int velocity);
+
+    // main loop から. マウス等の移動量をそのままのステップ数で出す
+    void addRelative(int counts);
+
+    // main loop から. 位置モードで軸の値 (0..255) に追従する
+    // 取りこぼしなく出すので追いつくまで遅れる
+    void setPosition(int pos);
+
+    // タイマー IRQ から TICK_HZ で呼ぶ
+    void tick()
+    {
+        int dir = 0;
+        int32_t inc = inc_;
+        uint32_t p = phase_ + inc;
+        if (inc >= 0 ? p < phase_ : p > phase_)
+        {
+            dir = inc >= 0 ? 1 : -1;
+        }
+        else if (int32_t d = target_ - relPos_)
+        {
+            // 相対入力と位置モードの分は 1 tick に 1 ステップずつ出す
+            dir = d > 0 ? 1 : -1;
+            relPos_ = relPos_ + dir;
+        }
+        phase_ = p;
+        state_ = (state_ + dir) & 3;
+    }
+
+    // A: 0110, B: 0011
+    std::pair<bool, bool> getEncState() const
+    {
+        int s = state_;
+        return {bool((s ^ (s >> 1)) & 1), bool(s >> 1)};
+    }
     uint32_t overrideButton(uint32_t buttons, int bitA, int bitB) const;
 
     void setAxis(int axis) { axis_ = axis; }
+    void setMode(Mode mode);
+    // 回転と未出力分を捨て, 位置モードの原点を取り直す
+    void reset();
+    Mode getMode() const { return mode_; }
     int getAxis() const { return axis_; }
     void setScale(int scale) { scale_ = scale; }
 
     explicit operator bool() const { return axis_ >= 0; }
 
+    // まだ出していないステップ数. 位置モードでは追従の遅れ
+    int getBacklog() const { return static_cast<int32_t>(target_ - relPos_); }
+
+protected:
+    void queueCounts(int counts, bool limit);
+
 private:
     int axis_ = -1;
     int scale_ = 1;
+    Mode mode_ = Mode::VELOCITY;
+
+    // 位相 (1 ステップ = 2^32) と tick あたりの増分
+    uint32_t phase_ = 0;
+    volatile int32_t inc_ = 0;
+
+    // 相対入力と位置モード. target_ は main loop, relPos_ は IRQ だけが書く
+    volatile uint32_t target_ = 0;
+    volatile uint32_t relPos_ = 0;
+    int relFrac_ = 0;
+
+    int lastPosition_ = 0;
+    bool hasPosition_ = false;
 
-    int rct_ = 0;
-    int state_ = 0; // 4相で変化する
-    // A: 0011
-    // B: 1001
+    volatile int state_ = 0; // 4相で変化する
 };
@@ -5,9 +5,17 @@
 
 #include "serializer.h"
 #include <hardware/flash.h>
-#include <hardware/sync.h>
+#include <hardware/irq.h>
+#include <hardware/timer.h>
+#include <hardware/regs/addressmap.h>
+#include <hardware/regs/m0plus.h>
+#include <pico/multicore.h>
 #include <cassert>
+#include <algorithm>
+#include "config_journal.h"
 #include "debug.h"
+#include "mem_stat.h"
+#include "trace.h"
 
 namespace
 {
@@ -16,60 +24,229 @@ namespace
         return 1536 * 1024; // flash 先頭から 1.5MiB
     }
 
+    // ジャーナルは領域を2つのバンクに分けて使うので, 書ける大きさは半分になる
+    // 1バンクで旧形式の領域と同じ 64KiB を書けるように倍にしてある
+    constexpr size_t getFlashRegionSize()
+    {
+        return 128 * 1024;
+    }
+
+    // 旧形式の領域. バンク0 と重なる
+    constexpr size_t getLegacyFlashRegionSize()
+    {
+        return 64 * 1024;
+    }
+
     constexpr const uint8_t *getFlashAddr()
     {
         return reinterpret_cast<const uint8_t *>(getFlashOfs() + XIP_BASE);
     }
+
+    static_assert(ConfigJournal::SECTOR_SIZE == FLASH_SECTOR_SIZE);
+    static_assert(ConfigJournal::PAGE_SIZE == FLASH_PAGE_SIZE);
+
+    uint32_t flashSafeIRQMask_ = 0;
+    util::CycleStats flashIRQOffStats_;
+
+    // flash 操作中は XIP が使えないので, flash 上のコードに入る IRQ だけを止める
+    // core1 が動いていれば止めておく
+    class PicoFlash : public ConfigJournal::Flash
+    {
+    public:
+        const uint8_t *getAddr() const override { return getFlashAddr(); }
+
+        void erase(uint32_t ofs, size_t size) override
+        {
+            auto t = begin();
+            TRACE(FLASH_ERASE_BEGIN, 0, 0, ofs);
+            flash_range_erase(getFlashOfs() + ofs, size);
+            TRACE(FLASH_ERASE_END);
+            end(t);
+        }
+
+        void program(uint32_t ofs, const uint8_t *p, size_t size) override
+        {
+            auto t = begin();
+            TRACE(FLASH_PROGRAM_BEGIN, 0, 0, ofs);
+            flash_range_program(getFlashOfs() + ofs, p, size);
+            TRACE(FLASH_PROGRAM_END);
+            end(t);
+        }
+
+    private:
+        struct State
+        {
+            uint32_t masked;
+            bool lockout;
+            uint32_t time;
+        };
+
+        static State begin()
+        {
+            State st;
+            st.lockout = multicore_lockout_victim_is_initialized(1);
+            if (st.lockout)
+            {
+                multicore_lockout_start_blocking();
+            }
+
+            auto &iser = *reinterpret_cast<io_rw_32 *>(PPB_BASE + M0PLUS_NVIC_ISER_OFFSET);
+            st.masked = iser & ~flashSafeIRQMask_;
+            irq_set_mask_enabled(st.masked, false);
+            st.time = time_us_32();
+            return st;
+        }
+
+        static void end(const State &st)
+        {
+            flashIRQOffStats_.add(time_us_32() - st.time);
+            irq_set_mask_enabled(st.masked, true);
+
+            if (st.lockout)
+            {
+                multicore_lockout_end_blocking();
+            }
+        }
+    };
+
+    // Serializer の出力を journal に渡す
+    class ConfigSource : public ConfigJournal::Source
+    {
+    public:
+        std::function<void(Serializer &s)> func;
+        size_t limitSize = 0;
+
+        void generate(ConfigJournal::Sink &sink) override
+        {
+            SinkAdapter adapter{sink};
+            Serializer s(&adapter, limitSize);
+            func(s);
+        }
+
+    private:
+        struct SinkAdapter : public Serializer::Sink
+        {
+            ConfigJournal::Sink &sink;
+            SinkAdapter(ConfigJournal::Sink &s) : sink(s) {}
+            void write(const uint8_t *p, size_t size) override { sink.write(p, size); }
+        };
+    };
+
+    ConfigSource configSource_;
+
+    ConfigJournal &getConfigJournal()
+    {
+        static PicoFlash flash;
+        static ConfigJournal inst(flash, getFlashRegionSize());
+        return inst;
+    }
 }
 
-Serializer::Serializer(size_t size, size_t margin)
+bool stepConfigFlash(bool allowErase)
 {
-    auto alignedSize = (size + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1);
-    data_.reserve(alignedSize);
-    data_.resize(sizeof(SerializeHeader));
-    limitSize_ = alignedSize - margin;
+    MEMSTAT_SCOPE(SERIALIZER);
+    auto &journal = getConfigJournal();
+    if (!journal.isBusy())
+    {
+        return false;
+    }
+    if (journal.step(allowErase))
+    {
+        return true;
+    }
+
+    TRACE(SAVE_END, 0, journal.isAborted() ? 1 : journal.isVerifyFailed() ? 2 : 0);
+    [[maybe_unused]] auto &st = journal.getStats();
+    DPRINT(("flash: %s. %d records, %d compactions, %d sectors erased. IRQ off max %dus\n",
+            journal.isAborted() ? "aborted" : journal.isVerifyFailed() ? "verify failed" : "done",
+            st.records, st.compactions, st.erasedSectors, (int)flashIRQOffStats_.getMax()));
+    DPRINT(("flash: %d aborts, %d verify failures\n", st.aborts, st.verifyFailures));
+    return false;
+}
+
+bool isConfigFlashBusy()
+{
+    return getConfigJournal().isBusy();
+}
+
+bool isConfigFlashAborted()
+{
+    return getConfigJournal().isAborted();
+}
+
+bool isConfigFlashVerifyFailed()
+{
+    return getConfigJournal().isVerifyFailed();
 }
 
-void Serializer::flash()
+void setFlashSafeIRQMask(uint32_t mask)
 {
-    auto actualSize = data_.size();
-    data_.resize((data_.size() + FLASH_SECTOR_SIZE - 1) & ~(FLASH_SECTOR_SIZE - 1));
+    flashSafeIRQMask_ = mask;
+}
 
-    SerializeHeader *p = reinterpret_cast<SerializeHeader *>(data_.data());
-    *p = {};
-    p->size = actualSize;
+util::CycleStats &getFlashIRQOffStats()
+{
+    return flashIRQOffStats_;
+}
 
-    auto dstOfs = getFlashOfs();
+bool beginConfigFlash(std::function<void(Serializer &s)> func, size_t margin)
+{
+    MEMSTAT_SCOPE(SERIALIZER);
+    auto &journal = getConfigJournal();
+    // 書き込み中は configSource_ を使っている
+    journal.flush();
 
+    configSource_.func = std::move(func);
+    configSource_.limitSize = journal.getMaxImageSize() - margin;
+    if (!journal.beginWrite(configSource_))
     {
-        auto save = save_and_disable_interrupts();
-        flash_range_erase(dstOfs, data_.size());
-        flash_range_program(dstOfs, data_.data(), data_.size());
-        restore_interrupts(save);
+        DPRINT(("flash: failed.\n"));
+        return false;
     }
+    DPRINT(("flash: begin.\n"));
+    TRACE(SAVE_BEGIN);
+    return true;
+}
 
-    DPRINT(("flash: %d bytes. actual %d bytes.\n", data_.size(), actualSize));
+const uint8_t *getStoredConfigImage(size_t &size)
+{
+    MEMSTAT_SCOPE(SERIALIZER);
+    return getConfigJournal().getImage(size);
 }
 
 ///////////////////
+// ジャーナルの内容をコピーせずに読む
 Deserializer::Deserializer()
 {
-    p_ = reinterpret_cast<const uint8_t *>(getFlashAddr());
-    header_ = reinterpret_cast<const SerializeHeader *>(p_);
+    // DELTA が残っていたら FULL にまとめて, flash 上で続けて読めるようにする
+    auto &journal = getConfigJournal();
+    journal.compact();
+    size_t size;
+    if (auto *image = journal.getImage(size))
+    {
+        p_ = image;
+        tail_ = p_ + size;
+        DPRINT(("Deserialize: %d bytes.\n", size));
+        return;
+    }
 
-    if (header_->magic != SerializeHeader::MAGIC ||
-        header_->version < SerializeHeader::MIN_ENABLED_VER)
+    // ジャーナルが無ければ旧形式を探す
+    // 次の保存はバンク1に書かれるので, それまではここに残っている
+    auto *header = reinterpret_cast<const SerializeHeader *>(getFlashAddr());
+    if (header->magic != SerializeHeader::MAGIC ||
+        header->version < SerializeHeader::MIN_ENABLED_VER ||
+        header->size < sizeof(SerializeHeader) ||
+        header->size > getLegacyFlashRegionSize())
     {
-        p_ = nullptr;
         return;
     }
 
-    tail_ = p_ + header_->size;
-    DPRINT(("Deserialize: %d bytes.\n", header_->size));
-    p_ += sizeof(SerializeHeader);
+    p_ = getFlashAddr() + sizeof(SerializeHeader);
+    tail_ = getFlashAddr() + header->size;
+    DPRINT(("Deserialize: %d bytes (legacy).\n", header->size - sizeof(SerializeHeader)));
 }
 
 Deserializer::~Deserializer()
 {
     assert(p_ <= tail_);
-}
\ No newline at end of file
+}
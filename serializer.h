@@ -9,7 +9,10 @@
 #include <cstdlib>
 #include <vector>
 #include <cstring>
+#include <functional>
+#include "util.h"
 
+// 旧形式 (ジャーナル化する前) のヘッダ. 読み込みだけ対応する
 struct SerializeHeader
 {
     inline static constexpr uint32_t
@@ -22,20 +25,85 @@ struct SerializeHeader
     uint32_t reserved[14]{};
 };
 
+class Serializer;
+
+// 設定の保存を始める. 前の書き込みが残っていたら先に終わらせる
+// func は書き終わるまでに何度か呼ばれるので, 毎回同じ内容を出力すること
+// 内容を全部メモリに置かないように, 必要な範囲だけを取り出しながら書く
+// limit から margin を引いたところで Serializer::exceedLimit() になる
+bool beginConfigFlash(std::function<void(Serializer &s)> func, size_t margin);
+
+// 設定の保存は beginConfigFlash() で始まり, stepConfigFlash() で少しずつ書かれる
+// main loop から毎回呼ぶ. allowErase が false ならセクタ消去は後回しにする
+// 書き込みが残っていれば true
+bool stepConfigFlash(bool allowErase);
+bool isConfigFlashBusy();
+// 書き込み中に内容が変わったのでやめた. 保存しなおすこと
+bool isConfigFlashAborted();
+// 書いた内容を読み返したら合わなかった. flash が傷んでいるかもしれない
+bool isConfigFlashVerifyFailed();
+
+// 最後に保存した内容. 次の保存が終わるまで有効
+// DELTA で保存したときは flash 上で続いていないので nullptr
+const uint8_t *getStoredConfigImage(size_t &size);
+
+// flash 操作中も止めない IRQ
+// ハンドラとそこから触るコード, データが全て RAM にあること
+void setFlashSafeIRQMask(uint32_t mask);
+
+// flash 操作で IRQ を止めていた時間 (us)
+util::CycleStats &getFlashIRQOffStats();
+
+// 出力は少しずつ Sink に渡し, 全体は持たない
 class Serializer
 {
-    std::vector<uint8_t> data_;
-    size_t limitSize_{};
+public:
+    class Sink
+    {
+    public:
+        virtual ~Sink() = default;
+        virtual void write(const uint8_t *p, size_t size) = 0;
+    };
+
+private:
+    static constexpr size_t BUFFER_SIZE = 64;
+
+    Sink *sink_;
+    uint8_t buffer_[BUFFER_SIZE];
+    size_t bufferSize_ = 0;
+    size_t size_;      // 出力全体の先頭から
+    size_t limitSize_;
 
 public:
-    Serializer(size_t size, size_t margin);
+    // sink が nullptr なら数えるだけ
+    // ofs は出力全体の中での位置. 一部分だけを出力するときに使う
+    Serializer(Sink *sink, size_t limitSize, size_t ofs = 0)
+        : sink_(sink), size_(ofs), limitSize_(limitSize)
+    {
+    }
+    ~Serializer() { flush(); }
 
-    bool exceedLimit() const { return data_.size() > limitSize_; }
-    void flash();
+    bool exceedLimit() const { return size_ > limitSize_; }
+    size_t getSize() const { return size_; }
+    size_t getLimitSize() const { return limitSize_; }
+
+    void flush()
+    {
+        if (bufferSize_ && sink_)
+        {
+            sink_->write(buffer_, bufferSize_);
+        }
+        bufferSize_ = 0;
+    }
 
     void append8u(uint8_t v)
     {
-        data_.push_back(v);
+        buffer_[bufferSize_++] = v;
+        ++size_;
+        if (bufferSize_ == BUFFER_SIZE)
+        {
+            flush();
+        }
     }
 
     void append8i(int8_t v)
@@ -70,33 +138,74 @@ public:
         append32i(v);
     }
 
+    // 7bit ずつ, 下位から
+    void appendVarint(uint32_t v)
+    {
+        while (v >= 0x80)
+        {
+            append8u((v & 0x7f) | 0x80);
+            v >>= 7;
+        }
+        append8u(v);
+    }
+
     void append(const void *p, size_t size)
     {
-        const auto *src = static_cast<const uint8_t *>(p);
-        data_.insert(data_.end(), src, src + size);
+        flush();
+        if (sink_)
+        {
+            sink_->write(static_cast<const uint8_t *>(p), size);
+        }
+        size_ += size;
     }
 };
 
+// 範囲外を読もうとしたら 0 を返して hasError() を立てる
 class Deserializer
 {
     const uint8_t *p_{};
     const uint8_t *tail_{};
-    const SerializeHeader *header_{};
+    bool error_ = false;
 
 public:
+    // 保存された設定を読む
     Deserializer();
+    // メモリ上の範囲を読む
+    Deserializer(const uint8_t *p, size_t size) : p_(p), tail_(p + size) {}
     ~Deserializer();
 
     explicit operator bool() const { return p_; }
 
+    bool hasError() const { return error_; }
+
+    const uint8_t *getPointer() const { return p_; }
+    size_t getRemaining() const { return tail_ - p_; }
+
+    bool skip(size_t size)
+    {
+        if (size > getRemaining())
+        {
+            error_ = true;
+            p_ = tail_;
+            return false;
+        }
+        p_ += size;
+        return true;
+    }
+
     int peek8u()
     {
+        if (p_ >= tail_)
+        {
+            error_ = true;
+            return 0;
+        }
         return *p_++;
     }
 
     int peek8i()
     {
-        return static_cast<int8_t>(*p_++);
+        return static_cast<int8_t>(peek8u());
     }
 
     int peek16u()
@@ -128,9 +237,28 @@ public:
         return peek32i();
     }
 
+    uint32_t peekVarint()
+    {
+        uint32_t v = 0;
+        for (int sh = 0; sh < 35; sh += 7)
+        {
+            int c = peek8u();
+            v |= static_cast<uint32_t>(c & 0x7f) << sh;
+            if (!(c & 0x80))
+            {
+                return v;
+            }
+        }
+        error_ = true;
+        return v;
+    }
+
     void peek(void *p, size_t size)
     {
-        memcpy(p, p_, size);
-        p_ += size;
+        auto *src = p_;
+        if (skip(size))
+        {
+            memcpy(p, src, size);
+        }
     }
 };
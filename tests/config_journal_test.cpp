@@ -0,0 +1,369 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Mon Oct 19 2026 00:20:51
+ */
+
+// ConfigJournal を RAM 上の flash モデルで動かす
+// モデルはセクタ/ページ境界を調べ, 消去されていないバイトへの書き込みを拒否する
+// 途中で電源を落とす (例外で抜ける) こともできる
+
+#include "config_journal.h"
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+
+namespace
+{
+    constexpr size_t REGION_SIZE = 128 * 1024;
+    constexpr size_t SECTOR_SIZE = ConfigJournal::SECTOR_SIZE;
+    constexpr size_t PAGE_SIZE = ConfigJournal::PAGE_SIZE;
+
+    int errors_ = 0;
+
+    void expect(bool f, const char *what)
+    {
+        if (!f && errors_++ < 10)
+        {
+            printf("  FAILED: %s\n", what);
+        }
+    }
+
+    struct PowerFail
+    {
+    };
+
+    class RamFlash : public ConfigJournal::Flash
+    {
+    public:
+        RamFlash() : mem_(REGION_SIZE, 0xff), eraseCount_(REGION_SIZE / SECTOR_SIZE) {}
+
+        const uint8_t *getAddr() const override { return mem_.data(); }
+
+        void erase(uint32_t ofs, size_t size) override
+        {
+            expect(ofs % SECTOR_SIZE == 0 && size % SECTOR_SIZE == 0, "erase alignment");
+            expect(ofs + size <= mem_.size(), "erase range");
+            for (size_t s = ofs; s < ofs + size; s += SECTOR_SIZE)
+            {
+                tick();
+                std::fill_n(&mem_[s], SECTOR_SIZE, 0xff);
+                ++eraseCount_[s / SECTOR_SIZE];
+            }
+        }
+
+        void program(uint32_t ofs, const uint8_t *p, size_t size) override
+        {
+            expect(ofs % PAGE_SIZE == 0 && size % PAGE_SIZE == 0, "program alignment");
+            expect(ofs + size <= mem_.size(), "program range");
+            for (size_t i = 0; i < size; ++i)
+            {
+                tick();
+                auto &m = mem_[ofs + i];
+                if (m != 0xff)
+                {
+                    expect(false, "program over unerased byte");
+                    throw PowerFail{};
+                }
+                // 壊れたセクタは書いた値の一部のビットが立たない
+                bool bad = (ofs + i) / SECTOR_SIZE == badSector_;
+                m = bad ? p[i] & 0xfe : p[i];
+            }
+        }
+
+        // n 回操作 (消去はセクタ, 書き込みはバイト) したところで電源を落とす. 負なら落とさない
+        void setFailAfter(long n) { failAfter_ = n; }
+        // 指定したセクタに正しく書けないようにする. 負なら壊れていない
+        void setBadSector(int sector) { badSector_ = sector; }
+
+        int getMaxEraseCount() const { return *std::max_element(eraseCount_.begin(), eraseCount_.end()); }
+        long getTotalEraseCount() const
+        {
+            long n = 0;
+            for (auto c : eraseCount_)
+            {
+                n += c;
+            }
+            return n;
+        }
+
+    private:
+        void tick()
+        {
+            if (failAfter_ == 0)
+            {
+                throw PowerFail{};
+            }
+            if (failAfter_ > 0)
+            {
+                --failAfter_;
+            }
+        }
+
+    private:
+        std::vector<uint8_t> mem_;
+        std::vector<int> eraseCount_;
+        long failAfter_ = -1;
+        int badSector_ = -1;
+    };
+
+    // 設定の内容を何回かに分けて流す
+    class VectorSource : public ConfigJournal::Source
+    {
+    public:
+        explicit VectorSource(const std::vector<uint8_t> &v) : v_(v) {}
+
+        void generate(ConfigJournal::Sink &sink) override
+        {
+            for (size_t i = 0; i < v_.size(); i += 100)
+            {
+                sink.write(v_.data() + i, std::min<size_t>(100, v_.size() - i));
+            }
+        }
+
+    private:
+        const std::vector<uint8_t> &v_;
+    };
+
+    std::mt19937 rand_(3);
+
+    int random(int n)
+    {
+        return std::uniform_int_distribution<int>(0, n - 1)(rand_);
+    }
+
+    // 設定の変更っぽく内容を変える
+    std::vector<uint8_t> mutate(std::vector<uint8_t> v)
+    {
+        int k = random(100);
+        if (k < 90)
+        {
+            // メニューの値の変更
+            for (int n = 1 + random(3); n; --n)
+            {
+                v[random(v.size())] = random(256);
+            }
+        }
+        else if (k < 97 && v.size() < 3000)
+        {
+            // パッドの設定の追加
+            for (int i = 0; i < 120; ++i)
+            {
+                v.push_back(random(256));
+            }
+        }
+        else if (v.size() > 300)
+        {
+            v.resize(v.size() - 120);
+        }
+        return v;
+    }
+
+    std::vector<uint8_t> readAll(ConfigJournal &j)
+    {
+        std::vector<uint8_t> v(j.getImageSize());
+        j.readImage(0, v.data(), v.size());
+        return v;
+    }
+
+    // 起動時と同じく FULL にまとめて flash 上から読む
+    bool loadsAs(RamFlash &flash, const std::vector<uint8_t> &expected)
+    {
+        ConfigJournal j(flash, REGION_SIZE);
+        j.compact();
+        size_t size;
+        auto *p = j.getImage(size);
+        return p && std::vector<uint8_t>(p, p + size) == expected;
+    }
+
+    void testSaves()
+    {
+        constexpr int SAVES = 10000;
+
+        RamFlash flash;
+        ConfigJournal j(flash, REGION_SIZE);
+        std::vector<uint8_t> image(600);
+        for (auto &v : image)
+        {
+            v = random(256);
+        }
+
+        for (int i = 0; i < SAVES; ++i)
+        {
+            image = mutate(image);
+            VectorSource source(image);
+            expect(j.write(source) && !j.isAborted(), "write");
+            expect(readAll(j) == image, "readImage after write");
+            if (i % 500 == 0)
+            {
+                expect(loadsAs(flash, image), "reload");
+            }
+        }
+
+        auto &st = j.getStats();
+        printf("%d saves (%zu bytes at end): %u records, %u compactions, %u pages\n",
+               SAVES, image.size(), st.records, st.compactions, st.programmedPages);
+        printf("  erases: %ld sectors total, max %d per sector, %.2f sectors per save\n",
+               flash.getTotalEraseCount(), flash.getMaxEraseCount(),
+               double(flash.getTotalEraseCount()) / SAVES);
+        // 毎回全体を書きなおすと先頭セクタは SAVES 回消される
+        expect(flash.getMaxEraseCount() < SAVES / 10, "wear");
+        expect(loadsAs(flash, image), "final reload");
+
+        // 同じ内容なら書かない
+        auto pages = st.programmedPages;
+        VectorSource source(image);
+        j.write(source);
+        expect(st.programmedPages == pages, "same content rewritten");
+    }
+
+    // 書き込みと起動時のまとめ直しの途中で電源が落ちても, 前の内容か新しい内容のどちらかが読める
+    void testPowerFail()
+    {
+        constexpr int TRIALS = 3000;
+
+        RamFlash flash;
+        std::vector<uint8_t> image(800);
+        for (auto &v : image)
+        {
+            v = random(256);
+        }
+        {
+            ConfigJournal j(flash, REGION_SIZE);
+            VectorSource source(image);
+            j.write(source);
+        }
+
+        int interrupted = 0;
+        int bootInterrupted = 0;
+        for (int t = 0; t < TRIALS; ++t)
+        {
+            auto next = mutate(image);
+            flash.setFailAfter(random(t & 1 ? 600 : 6000));
+            bool failed = false;
+            try
+            {
+                ConfigJournal j(flash, REGION_SIZE);
+                expect(readAll(j) == image, "content before write");
+                VectorSource source(next);
+                j.write(source);
+            }
+            catch (PowerFail &)
+            {
+                failed = true;
+                ++interrupted;
+            }
+
+            // 起動時の compact() も落とす
+            flash.setFailAfter(random(6000));
+            try
+            {
+                ConfigJournal j(flash, REGION_SIZE);
+                j.compact();
+            }
+            catch (PowerFail &)
+            {
+                ++bootInterrupted;
+            }
+            flash.setFailAfter(-1);
+
+            ConfigJournal j(flash, REGION_SIZE);
+            auto got = readAll(j);
+            expect(got == next || (failed && got == image), "content after power fail");
+            expect(loadsAs(flash, got), "reload after power fail");
+            image = got;
+        }
+        printf("power fail: %d trials, %d writes and %d boot compactions interrupted\n",
+               TRIALS, interrupted, bootInterrupted);
+    }
+
+    // 書いている間に内容が変わったらやめて, 前の内容を残す
+    void testSourceChange()
+    {
+        RamFlash flash;
+        ConfigJournal j(flash, REGION_SIZE);
+        // window (1 セクタ) を2つ以上使う大きさ
+        std::vector<uint8_t> image(6000, 0x55);
+        {
+            VectorSource source(image);
+            j.write(source);
+        }
+
+        // FULL になるくらい変える
+        auto next = image;
+        for (size_t i = 0; i < next.size(); i += 2)
+        {
+            next[i] = 0xaa;
+        }
+        VectorSource source(next);
+        expect(j.beginWrite(source), "beginWrite");
+        j.step();
+        next.push_back(1);
+        j.flush();
+        expect(j.isAborted() && !j.isVerifyFailed(), "abort on source change");
+        expect(readAll(j) == image, "content after abort");
+        expect(loadsAs(flash, image), "reload after abort");
+    }
+
+    // FULL が書けないときは RAM に展開した内容を返す
+    void testBadSector()
+    {
+        RamFlash flash;
+        std::vector<uint8_t> image(1000, 0x11);
+        {
+            ConfigJournal j(flash, REGION_SIZE);
+            VectorSource source(image);
+            j.write(source);
+            image[10] = 0x22;
+            j.write(source);
+            size_t size;
+            expect(!j.getImage(size), "DELTA is not contiguous");
+        }
+
+        // バンク1 にある FULL を読みながらバンク0 に書けない
+        flash.setBadSector(0);
+        ConfigJournal j(flash, REGION_SIZE);
+        j.compact();
+        expect(j.getStats().verifyFailures == 1, "verify failure");
+        size_t size;
+        auto *p = j.getImage(size);
+        expect(p && std::vector<uint8_t>(p, p + size) == image, "resident image");
+
+        // 同じバンクへの書き込みは読み返しで失敗する. 内容が変わったのとは区別する
+        {
+            auto large = image;
+            std::fill(large.begin(), large.end(), 0x44);
+            VectorSource source(large);
+            j.write(source);
+            expect(j.isVerifyFailed() && !j.isAborted(), "verify failed on bad bank");
+            expect(readAll(j) == image, "content after verify failure");
+        }
+
+        // その後の DELTA も反映される
+        image[20] = 0x33;
+        VectorSource source(image);
+        j.write(source);
+        p = j.getImage(size);
+        expect(p && std::vector<uint8_t>(p, p + size) == image, "resident image after DELTA");
+
+        flash.setBadSector(-1);
+        expect(loadsAs(flash, image), "reload after repair");
+    }
+}
+
+int main()
+{
+    testSaves();
+    testPowerFail();
+    testSourceChange();
+    testBadSector();
+
+    if (errors_)
+    {
+        printf("%d error(s)\n", errors_);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
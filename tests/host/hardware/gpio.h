@@ -0,0 +1,17 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Mon Oct 19 2026 01:05:33
+ */
+#pragma once
+
+#include <stdint.h>
+
+// ホストでビルドするときの hardware/gpio.h の代わり
+// ピンは何もしない
+
+#define GPIO_OUT 1
+#define GPIO_IN 0
+
+inline void gpio_init(unsigned) {}
+inline void gpio_set_dir(unsigned, bool) {}
+inline void gpio_put(unsigned, bool) {}
@@ -0,0 +1,21 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Mon Oct 19 2026 00:12:40
+ */
+#pragma once
+
+#include <stdint.h>
+
+// ホストでビルドするときの hardware/structs/systick.h の代わり
+// カウンタは進まない
+
+struct systick_hw_t
+{
+    uint32_t csr;
+    uint32_t rvr;
+    uint32_t cvr;
+    uint32_t calib;
+};
+
+inline systick_hw_t hostSysTick_{};
+#define systick_hw (&hostSysTick_)
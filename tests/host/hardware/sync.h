@@ -0,0 +1,13 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 14:21:07
+ */
+#pragma once
+
+#include <stdint.h>
+
+// ホストでビルドするときの hardware/sync.h の代わり
+// 割り込みは無いので何もしない
+
+inline uint32_t save_and_disable_interrupts() { return 0; }
+inline void restore_interrupts(uint32_t) {}
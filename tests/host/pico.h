@@ -0,0 +1,12 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 23:02:17
+ */
+#pragma once
+
+// ホストでビルドするときの pico.h の代わり
+// RAM に置く指定などは何もしない
+
+#define __not_in_flash_func(func_name) func_name
+#define __force_inline inline __attribute__((always_inline))
+#define __isr
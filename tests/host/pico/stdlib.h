@@ -0,0 +1,21 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Mon Oct 19 2026 01:05:33
+ */
+#pragma once
+
+#include <assert.h>
+#include <stdint.h>
+#include "pico.h"
+#include "hardware/gpio.h"
+
+// ホストでビルドするときの pico/stdlib.h の代わり
+// 待ちは何もしない. panic() はテスト側で用意する
+
+#ifndef PICO_DEFAULT_LED_PIN
+#define PICO_DEFAULT_LED_PIN 25
+#endif
+
+inline void sleep_ms(uint32_t) {}
+
+void panic(const char *fmt, ...);
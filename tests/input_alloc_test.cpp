@@ -0,0 +1,252 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Mon Oct 19 2026 01:12:47
+ */
+
+// 入力の経路 (HID レポート -> PadManager::setData() -> update()) が定常状態でヒープを使わないこと
+// pad / translator / memstat は本物を使い, operator new は mem_stat.cpp のもので数える
+// 設定の編集, 保存後の rebind(), 起動時の読み込み, 2P混在モード, 抜き差しを通す
+
+#include "hid_info.h"
+#include "pad_manager.h"
+#include "serializer.h"
+#include "mem_stat.h"
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+// mem_stat.cpp が使うリンカスクリプトのシンボル
+extern "C"
+{
+    char __end__;
+    char __HeapLimit;
+    uint32_t __StackBottom;
+    uint32_t __StackTop;
+    uint32_t __StackOneBottom;
+    uint32_t __StackOneTop;
+}
+
+// 入力の経路で確保すると mem_stat.cpp から呼ばれる
+void panic(const char *fmt, ...)
+{
+    printf("  panic: %s\n", fmt);
+}
+
+// 起動時の読み込みは flash の代わりにテストで作った内容を使う
+Deserializer::Deserializer() : p_(nullptr), tail_(nullptr) {}
+Deserializer::~Deserializer() {}
+
+namespace
+{
+    int errors_ = 0;
+
+    void expect(bool f, const char *what)
+    {
+        if (!f)
+        {
+            printf("  FAILED: %s\n", what);
+            ++errors_;
+        }
+    }
+
+    struct VectorSink : Serializer::Sink
+    {
+        std::vector<uint8_t> v;
+        void write(const uint8_t *p, size_t size) override { v.insert(v.end(), p, p + size); }
+    };
+
+    // ボタン 16個, ハット, X/Y 8bit
+    const uint8_t desc_[] = {
+        0x05, 0x01, 0x09, 0x05, 0xa1, 0x01,
+        0x05, 0x09, 0x19, 0x01, 0x29, 0x10, 0x15, 0x00, 0x25, 0x01, 0x75, 0x01, 0x95, 0x10, 0x81, 0x02,
+        0x05, 0x01, 0x09, 0x39, 0x15, 0x00, 0x25, 0x07, 0x75, 0x04, 0x95, 0x01, 0x81, 0x42,
+        0x75, 0x04, 0x95, 0x01, 0x81, 0x01,
+        0x09, 0x30, 0x09, 0x31, 0x15, 0x00, 0x26, 0xff, 0x00, 0x75, 0x08, 0x95, 0x02, 0x81, 0x02,
+        0xc0};
+
+    HIDInfo hid_;
+
+    struct Device
+    {
+        int port;
+        int vid;
+        int pid;
+    };
+
+    // 全ポートに別の機器
+    const Device devices_[PadManager::N_PORTS] = {
+        {0, 0x1234, 0x5678},
+        {1, 0x2345, 0x0001},
+        {2, 0x2345, 0x0002},
+        {3, 0x0f0d, 0x00c1},
+        {4, 0x054c, 0x0ce6},
+    };
+
+    void report(const Device &d, int i, bool center = false)
+    {
+        MEMSTAT_SCOPE(INPUT);
+        uint8_t r[5] = {uint8_t(i), uint8_t(i >> 8),
+                        uint8_t(center || i % 9 == 8 ? 0x08 : i % 8),
+                        uint8_t(center ? 128 : i * 7), uint8_t(center ? 128 : i * 3)};
+        PadManager::PadInput in;
+        in.vid = d.vid;
+        in.pid = d.pid;
+        hid_.parseReport(r, sizeof(r), in.buttons[0], in.hat, in.analogs, in.relatives);
+        PadManager::instance().setData(d.port, in);
+    }
+
+    uint32_t getInputAllocs()
+    {
+        return memstat::getTagStats(memstat::Tag::INPUT).count;
+    }
+
+    // n 回ずつ全機器のレポートを処理して, その間の確保回数を返す
+    uint32_t run(int n, int nDevices = PadManager::N_PORTS)
+    {
+        auto &pm = PadManager::instance();
+        auto before = getInputAllocs();
+        for (int i = 0; i < n; ++i)
+        {
+            for (int k = 0; k < nDevices; ++k)
+            {
+                report(devices_[k], i);
+            }
+            MEMSTAT_SCOPE(INPUT);
+            pm.update(1000, false, false, false);
+            volatile uint32_t b = pm.getButtons(0);
+            (void)b;
+        }
+        return getInputAllocs() - before;
+    }
+
+    void check(const char *what, uint32_t allocs)
+    {
+        printf("%-28s %u allocs on the input path\n", what, allocs);
+        expect(allocs == 0, what);
+    }
+
+    void mount(const Device &d)
+    {
+        MEMSTAT_SCOPE(HID);
+        PadManager::instance().resetLatestPadData(d.port);
+        PadManager::instance().preloadConfig(d.vid, d.pid);
+    }
+
+    void unmount(const Device &d)
+    {
+        MEMSTAT_SCOPE(HID);
+        PadManager::instance().releaseConfig(d.vid, d.pid);
+    }
+
+    // ボタン設定モードを1周する. 設定中の確保は MENU / TRANSLATOR に数える
+    void configure(const Device &d)
+    {
+        auto &pm = PadManager::instance();
+        report(d, 0, true);
+        pm.enterConfigMode();
+        for (int b = 0; b < 80 && !pm.isNormalMode(); ++b)
+        {
+            for (int k = 0; k < 3; ++k)
+            {
+                report(d, 1 << (b % 16), true);
+                pm.update(1000, false, false, false);
+            }
+            for (int k = 0; k < 3; ++k)
+            {
+                report(d, 0, true);
+                pm.update(20000000, false, false, false);
+            }
+        }
+        expect(pm.isNormalMode(), "config mode finished");
+    }
+
+    std::vector<uint8_t> save()
+    {
+        MEMSTAT_SCOPE(SERIALIZER);
+        VectorSink sink;
+        {
+            Serializer s(&sink, 1 << 20);
+            PadManager::instance().serialize(s);
+        }
+        PadManager::instance().onConfigStored(sink.v.data(), sink.v.size());
+        return sink.v;
+    }
+
+    void load(const std::vector<uint8_t> &image)
+    {
+        MEMSTAT_SCOPE(SERIALIZER);
+        Deserializer s(image.data(), image.size());
+        PadManager::instance().deserialize(s);
+    }
+}
+
+int main()
+{
+    auto &pm = PadManager::instance();
+    hid_.parseDesc(desc_, desc_ + sizeof(desc_));
+
+    for (auto &d : devices_)
+    {
+        mount(d);
+    }
+    memstat::setSteadyState(true);
+    check("default config", run(2000));
+
+    // 設定を作ると overlay に入る
+    configure(devices_[0]);
+    check("after config mode", run(2000));
+
+    // 保存すると保存した方を参照しなおす
+    auto image = save();
+    check("after save", run(2000));
+
+    // 2P混在モードでは portOfs 1 の設定も使う
+    pm.setTwinPortMode(true);
+    for (auto &d : devices_)
+    {
+        configure(d);
+    }
+    check("twin port, in overlay", run(2000));
+    image = save();
+    check("twin port, after save", run(2000));
+
+    // 起動時: 保存した内容を読んでから全ポートに接続. 全部の設定が展開されていること
+    load(image);
+    for (auto &d : devices_)
+    {
+        unmount(d);
+        mount(d);
+    }
+    check("twin port, after boot", run(2000));
+
+    // 抜き差し. 抜いた機器の設定を捨てても残りは展開されたまま
+    unmount(devices_[1]);
+    unmount(devices_[2]);
+    check("after unmount", run(2000, 1));
+    mount(devices_[2]);
+    mount(devices_[1]);
+    check("after remount", run(2000));
+
+    // 同じ機器を2つ繋いで1つ抜いても捨てない
+    mount(devices_[3]);
+    unmount(devices_[3]);
+    check("same device twice", run(2000));
+
+    // 見張りが効くこと
+    auto steady = memstat::getSteadyAllocCount();
+    {
+        MEMSTAT_SCOPE(INPUT);
+        static int *volatile p;
+        p = new int[4];
+        delete[] p;
+    }
+    expect(memstat::getSteadyAllocCount() == steady + 1, "allocation is counted");
+
+    if (errors_)
+    {
+        printf("%d error(s)\n", errors_);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
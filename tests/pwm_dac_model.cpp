@@ -0,0 +1,163 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 23:31:06
+ */
+
+// PWMDAC のディザパターンのモデル
+// 全レベルについて, パターン 1 巡の平均が目標値に一致するかと,
+// アダプタの RC フィルタを通したあとに残るディザのリップルを調べる
+// PWM 1 周期の中のリップル (10bit PWM そのもの) はディザの有無で変わらないので含めない
+
+#include "pwm_dac.h"
+#include "dac_table.h"
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <set>
+
+namespace
+{
+    constexpr double PWM_FREQ = 125e6 / 1024;
+    // アダプタの RC フィルタのカットオフ
+    constexpr double RC_CORNER_HZ = 1000;
+    // 14bit で何 LSB までのリップルを許すか (12bit 相当なら 4)
+    constexpr double MAX_RIPPLE_LSB = 2;
+
+    constexpr int N = PWMDAC::PATTERN_SIZE;
+
+    // 1 巡の周期ごとの duty (1/1024 単位)
+    using Pattern = std::array<int, N>;
+
+    Pattern makePattern(int level)
+    {
+        Pattern p;
+        for (int k = 0; k < N; ++k)
+        {
+            p[k] = PWMDAC::getPatternLevel(level, k);
+        }
+        return p;
+    }
+
+    // 端数を先頭から詰めた場合 (比較用)
+    Pattern makeSequentialPattern(int level)
+    {
+        Pattern p;
+        for (int k = 0; k < N; ++k)
+        {
+            p[k] = (level >> PWMDAC::DITHER_BITS) + (k < (level & (N - 1)) ? 1 : 0);
+        }
+        return p;
+    }
+
+    // RC を通して定常になったあとの p-p (14bit LSB 単位)
+    double getRipple(const Pattern &p)
+    {
+        double a = 1 - std::exp(-2 * M_PI * RC_CORNER_HZ / PWM_FREQ);
+        double y = 0;
+        for (int k = 0; k < N; ++k)
+        {
+            y += p[k];
+        }
+        y /= N;
+
+        // 1 巡の平均から始めて十分回す
+        double lo = 1e9;
+        double hi = -1e9;
+        for (int i = 0; i < N * 64; ++i)
+        {
+            y += a * (p[i % N] - y);
+            if (i >= N * 48)
+            {
+                lo = std::min(lo, y);
+                hi = std::max(hi, y);
+            }
+        }
+        return (hi - lo) * N;
+    }
+}
+
+int main()
+{
+    int errors = 0;
+    auto expect = [&](bool f, const char *what, int level)
+    {
+        if (!f && errors++ < 10)
+        {
+            printf("FAILED: %s (level %d)\n", what, level);
+        }
+    };
+
+    double maxRipple = 0;
+    double maxSeqRipple = 0;
+    int worstLevel = 0;
+    Pattern prev{};
+    for (int level = 0; level <= PWMDAC::LEVEL_MAX; ++level)
+    {
+        auto p = makePattern(level);
+
+        int sum = 0;
+        for (int k = 0; k < N; ++k)
+        {
+            sum += p[k];
+            expect(p[k] >= 0 && p[k] <= 1024, "CC out of range", level);
+            // どの周期もレベルに対して単調
+            expect(p[k] >= prev[k], "not monotonic", level);
+        }
+        // 1 巡の平均は目標と一致する
+        expect(sum == level, "mean differs from target", level);
+        prev = p;
+
+        double r = getRipple(p);
+        if (r > maxRipple)
+        {
+            maxRipple = r;
+            worstLevel = level;
+        }
+        maxSeqRipple = std::max(maxSeqRipple, getRipple(makeSequentialPattern(level)));
+    }
+    expect(maxRipple <= MAX_RIPPLE_LSB, "ripple", worstLevel);
+
+    // 線形化テーブルを通した出力が入力ごとに別のレベルになるか
+    std::set<int> levels;
+    std::set<int> levels10;
+    for (int v = 0; v < DAC_TABLE_SIZE; ++v)
+    {
+        int l = getDACLevel(v);
+        expect(l >= 0 && l <= PWMDAC::LEVEL_MAX, "DAC level out of range", l);
+        levels.insert(l);
+        levels10.insert((l + N / 2) >> PWMDAC::DITHER_BITS);
+    }
+
+    // setLevel() のパターン書き込み (ホストでの時間)
+    uint16_t cc[N][2]{};
+    constexpr int LOOPS = 1000000;
+    auto t0 = std::chrono::steady_clock::now();
+    for (int i = 0; i < LOOPS; ++i)
+    {
+        int level = i & (PWMDAC::LEVEL_MAX - 1);
+        for (int k = 0; k < N; ++k)
+        {
+            cc[k][0] = PWMDAC::getPatternLevel(level, k);
+        }
+        asm volatile("" : : "r"(cc) : "memory");
+    }
+    auto t1 = std::chrono::steady_clock::now();
+
+    printf("levels        : 0..%d, mean exact for all\n", PWMDAC::LEVEL_MAX);
+    printf("ripple (RC %.0fHz): max %.2f LSB14 at level %d (sequential fill %.2f)\n",
+           RC_CORNER_HZ, maxRipple, worstLevel, maxSeqRipple);
+    printf("DAC table     : %zu distinct levels for %d inputs (%zu at 10 bits)\n",
+           levels.size(), DAC_TABLE_SIZE, levels10.size());
+    printf("pattern fill  : %.1f ns on host, %d CC writes per setLevel\n",
+           std::chrono::duration<double, std::nano>(t1 - t0).count() / LOOPS, N);
+
+    if (errors)
+    {
+        printf("%d error(s)\n", errors);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
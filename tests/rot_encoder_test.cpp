@@ -0,0 +1,325 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 23:48:19
+ */
+
+// RotEncoder を TICK_HZ で回して A/B 相をデコードし,
+// 出てきたステップ数を要求と比べる
+// 位置モードは軸の値の累計 (WRAP なら mod 256 を展開したもの) に対する誤差を見る
+
+#include "rot_encoder.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+
+namespace
+{
+    int errors_ = 0;
+
+    void expect(bool f, const char *what)
+    {
+        if (!f)
+        {
+            printf("  FAILED: %s\n", what);
+            ++errors_;
+        }
+    }
+
+    // A/B 相から位置を数える
+    // 1 tick で 2 相進んだら取りこぼし
+    struct Decoder
+    {
+        int prev = 0;
+        long steps = 0;
+        int skips = 0;
+
+        void update(const RotEncoder &re)
+        {
+            auto [a, b] = re.getEncState();
+            int s = (a ? 1 : 0) ^ (b ? 3 : 0); // A: 0110, B: 0011 -> 0123
+            switch ((s - prev) & 3)
+            {
+            case 1:
+                ++steps;
+                break;
+            case 3:
+                --steps;
+                break;
+            case 2:
+                ++skips;
+                break;
+            }
+            prev = s;
+        }
+    };
+
+    constexpr int MAX_RATE = RotEncoder::TICK_HZ / 2;
+
+    // velocity * scale [ステップ/秒] で回ること
+    // MAX_RATE を越える要求は取りこぼさずに MAX_RATE で頭打ちになること
+    void testVelocity(int velocity, int scale)
+    {
+        constexpr int SECONDS = 4;
+
+        RotEncoder re;
+        re.setAxis(0);
+        re.setScale(scale);
+        re.setVelocity(velocity);
+
+        Decoder dec;
+        for (int t = 0; t < RotEncoder::TICK_HZ * SECONDS; ++t)
+        {
+            re.tick();
+            dec.update(re);
+        }
+
+        double rate = double(dec.steps) / SECONDS;
+        long request = long(velocity) * scale;
+        long expected = std::clamp<long>(request, -MAX_RATE, MAX_RATE);
+        printf("velocity %6d x %3d: %9.2f steps/s (request %ld)\n",
+               velocity, scale, rate, request);
+
+        expect(!dec.skips, "skipped quadrature state");
+        // 位相の切り捨て分で 1 ステップまで遅れてよい
+        expect(std::labs(dec.steps - expected * SECONDS) <= 1, "rate");
+    }
+
+    // 位置モードでの追従
+    // 軸の値 (0..255) を HID レポート相当の間隔で変え, レポート毎に setPosition() する
+    // 出力の累計は floor(移動量 * scale / COUNT_SCALE_UNIT) と一致しなければならない
+    struct PositionCase
+    {
+        const char *name;
+        RotEncoder::Mode mode;
+        int scale;
+        double (*input)(double t); // 時刻 (秒) -> 軸の位置 (WRAP なら展開した値)
+        double seconds;
+    };
+
+    constexpr int REPORT_US = 8000;
+    constexpr int TICK_US = 1000000 / RotEncoder::TICK_HZ;
+
+    int getAxisValue(const PositionCase &c, double t)
+    {
+        int v = static_cast<int>(std::floor(c.input(t)));
+        if (c.mode == RotEncoder::Mode::POSITION_WRAP)
+        {
+            return v & 255;
+        }
+        return std::clamp(v, 0, 255);
+    }
+
+    long getExpectedSteps(long moved, int scale)
+    {
+        // 負方向も切り捨て
+        long v = moved * scale;
+        return v >= 0 ? v / RotEncoder::COUNT_SCALE_UNIT
+                      : -((RotEncoder::COUNT_SCALE_UNIT - 1 - v) / RotEncoder::COUNT_SCALE_UNIT);
+    }
+
+    void testPosition(const PositionCase &c)
+    {
+        RotEncoder re;
+        re.setAxis(0);
+        re.setScale(c.scale);
+        re.setMode(c.mode);
+
+        Decoder dec;
+        int axis = getAxisValue(c, 0);
+        int first = axis;
+        long moved = 0; // 最初の値からの移動量 (展開済み)
+        int maxLag = 0;
+        int maxJump = 0; // 1 レポートで動いたステップ数の最大
+        int maxBacklog = 0;
+
+        int end = static_cast<int>(c.seconds * 1000000);
+        for (int us = 0; us < end; us += TICK_US)
+        {
+            if (us % REPORT_US == 0)
+            {
+                int v = getAxisValue(c, us * 1e-6);
+                long prevSteps = getExpectedSteps(moved, c.scale);
+                if (c.mode == RotEncoder::Mode::POSITION_WRAP)
+                {
+                    moved += ((v - axis + 128) & 255) - 128;
+                }
+                else
+                {
+                    moved = v - first;
+                }
+                axis = v;
+                maxJump = std::max<int>(maxJump, std::labs(getExpectedSteps(moved, c.scale) - prevSteps));
+                re.setPosition(axis);
+            }
+            re.tick();
+            dec.update(re);
+
+            long lag = std::labs(getExpectedSteps(moved, c.scale) - dec.steps);
+            maxLag = std::max<int>(maxLag, lag);
+            maxBacklog = std::max(maxBacklog, std::abs(re.getBacklog()));
+        }
+
+        // 溜まった分を出しきる
+        int drainTicks = 0;
+        while (re.getBacklog() && drainTicks < RotEncoder::TICK_HZ)
+        {
+            re.tick();
+            dec.update(re);
+            ++drainTicks;
+        }
+
+        long expected = getExpectedSteps(moved, c.scale);
+        printf("%-22s moved %6ld, steps %6ld (expect %6ld), max lag %3d (jump %3d), drain %d ticks\n",
+               c.name, moved, dec.steps, expected, maxLag, maxJump, drainTicks);
+
+        expect(!dec.skips, "skipped quadrature state");
+        expect(dec.steps == expected, "final position");
+        // 次のレポートまでに追いつくので, 遅れは 1 レポート分を越えない
+        expect(maxLag <= maxJump, "tracking error");
+        // 1 tick 1 ステップで出すので残りの分だけで追いつく
+        expect(drainTicks <= maxBacklog, "backlog drain");
+    }
+
+    // 抜き差し. PadManager と同じく接続, 切断で reset() し, レポートが来たときだけ setPosition() する
+    // 接続直後の値や切断で中心に戻った値でステップが出てはいけない
+    void testReconnect(RotEncoder::Mode mode)
+    {
+        constexpr int SCALE = 100;
+        constexpr int REPORT_TICKS = REPORT_US / TICK_US;
+
+        RotEncoder re;
+        re.setAxis(0);
+        re.setScale(SCALE);
+        re.setMode(mode);
+
+        Decoder dec;
+        auto run = [&](int ticks)
+        {
+            for (int i = 0; i < ticks; ++i)
+            {
+                re.tick();
+                dec.update(re);
+            }
+        };
+        // from から to まで 1 レポート 1 カウントずつ動かす
+        auto move = [&](int from, int to)
+        {
+            for (int v = from;; v += to > from ? 1 : -1)
+            {
+                re.setPosition(v & 255);
+                run(REPORT_TICKS);
+                if (v == to)
+                {
+                    break;
+                }
+            }
+        };
+
+        // 未接続のまま
+        run(RotEncoder::TICK_HZ / 10);
+        expect(dec.steps == 0 && !re.getBacklog(), "idle before plug");
+
+        // 中心から遠い位置で接続する
+        re.reset();
+        move(30, 60);
+        long plugged = dec.steps;
+
+        // 抜く
+        re.reset();
+        run(RotEncoder::TICK_HZ / 10);
+        long unplugged = dec.steps;
+
+        // 別の位置で挿し直して逆に回す
+        re.reset();
+        move(200, 190);
+        run(RotEncoder::TICK_HZ / 10);
+
+        long expected = unplugged + getExpectedSteps(-10, SCALE);
+        printf("reconnect %-6s plug %3ld (expect %3ld), after unplug %3ld, replug %3ld (expect %3ld)\n",
+               mode == RotEncoder::Mode::POSITION ? "paddle" : "dial",
+               plugged, getExpectedSteps(30, SCALE), unplugged, dec.steps, expected);
+
+        expect(!dec.skips, "skipped quadrature state");
+        expect(plugged == getExpectedSteps(30, SCALE), "steps after plug");
+        expect(unplugged == plugged, "steps after unplug");
+        expect(dec.steps == expected, "steps after replug");
+    }
+}
+
+int main()
+{
+    for (int v : {0, 1, 7, -13, 100, -127, 500, -2500, 4999})
+    {
+        testVelocity(v, 1);
+    }
+    testVelocity(100, 10);
+    testVelocity(-37, 100);
+
+    // 飽和
+    for (int v : {5000, -5000, 20000, -20000})
+    {
+        testVelocity(v, 1);
+    }
+    testVelocity(127, 256);
+
+    const PositionCase positionCases[] = {
+        // パドル: 中心から ±120 をゆっくり往復
+        {"paddle 1:1", RotEncoder::Mode::POSITION, 50,
+         [](double t)
+         { return 128 + 120 * std::sin(2 * M_PI * 0.5 * t); },
+         3},
+        // 速く振る. 1 レポートで最大 ~24 ステップ
+        {"paddle x5.12 fast", RotEncoder::Mode::POSITION, 256,
+         [](double t)
+         { return 128 + 120 * std::sin(2 * M_PI * 2 * t); },
+         3},
+        // 端に張り付く
+        {"paddle clamp", RotEncoder::Mode::POSITION, 100,
+         [](double t)
+         { return 128 + 400 * std::sin(2 * M_PI * 1 * t); },
+         3},
+        // 端から端へ一気に動かす. 溜まった分を取りこぼさずに出しきること
+        {"paddle jump", RotEncoder::Mode::POSITION, 256,
+         [](double t)
+         { return t < 1 ? 0.0 : 255.0; },
+         1.05},
+        // 1 カウント 7/50 ステップ. 端数の持ち越しで累計がずれないこと
+        {"paddle fraction 7/50", RotEncoder::Mode::POSITION, 7,
+         [](double t)
+         { return 128 + 127 * std::sin(2 * M_PI * 1.3 * t); },
+         3},
+        // 1 カウントを行ったり来たり. 端数が溜まって漂わないこと
+        {"paddle dither 3/50", RotEncoder::Mode::POSITION, 3,
+         [](double t)
+         { return 100.5 + 0.7 * std::sin(2 * M_PI * 40 * t); },
+         3},
+        // ダイヤル: 255 -> 0 をまたいで回し続ける
+        {"dial 1:1 spinning", RotEncoder::Mode::POSITION_WRAP, 50,
+         [](double t)
+         { return 300 * t + 40 * std::sin(2 * M_PI * t); },
+         3},
+        {"dial x4 reverse", RotEncoder::Mode::POSITION_WRAP, 200,
+         [](double t)
+         { return -500 * t; },
+         3},
+        {"dial fraction 13/50", RotEncoder::Mode::POSITION_WRAP, 13,
+         [](double t)
+         { return 250 - 1000 * t + 80 * std::sin(2 * M_PI * 3 * t); },
+         3},
+    };
+    for (auto &c : positionCases)
+    {
+        testPosition(c);
+    }
+    testReconnect(RotEncoder::Mode::POSITION);
+    testReconnect(RotEncoder::Mode::POSITION_WRAP);
+
+    if (errors_)
+    {
+        printf("%d error(s)\n", errors_);
+        return 1;
+    }
+    printf("OK\n");
+    return 0;
+}
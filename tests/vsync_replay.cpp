@@ -0,0 +1,439 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 23:05:41
+ */
+
+// 記録した同期信号の ADC サンプルを VSyncDetector に流して, 精度と処理時間を見る
+//
+//   vsync_replay capture.bin [edges.txt] [-p periodNs] [-b blockSize] [-n bufferSize]
+//
+// capture.bin は 8bit サンプルをそのまま並べたもの (DMA バッファの中身)
+// edges.txt は正解の VSync 開始位置 (サンプル番号) を 1 行に 1 つ. 無ければ FPS と処理時間だけ
+// 既定のサンプリングは SYNCHRO (2000ns, 32, 512). FPS 設定なら -p 8000 -b 8 -n 1024
+//
+// 引数が無ければ合成した波形 (ノイズ, インターレース, 途切れ) を流して,
+// 基準から外れたら失敗で終わる
+
+#include "vsync_detector.h"
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <random>
+#include <vector>
+
+namespace
+{
+    // 時刻 0 付近で引き算が負にならないようにずらす
+    constexpr uint64_t BASE_US = 1000000;
+    // 最初の数フレームは min/max が決まっていないので数えない
+    constexpr double WARMUP_US = 100000;
+
+    struct Sampling
+    {
+        int periodNs = 2000;
+        int blockSize = 32;
+        int bufferSize = 512;
+    };
+
+    struct Capture
+    {
+        std::vector<uint8_t> samples;
+        std::vector<double> edges; // 正解 (サンプル番号)
+    };
+
+    struct Result
+    {
+        int fps100 = 0;
+        int truthFPS100 = 0;
+        bool locked = false;
+        int truthEdges = 0;
+        int detected = 0; // 受け付けたエッジ
+        int matched = 0;
+        int falseEdges = 0;  // 受け付けたが正解に無いエッジ
+        int missedEdges = 0; // 正解にあって検出しなかったエッジ
+        double meanError = 0; // us
+        double maxError = 0;
+        uint32_t detMissed = 0; // VSyncDetector 自身の数え
+        uint32_t detExtra = 0;
+        double nsPerCall = 0;
+        double maxNsPerCall = 0;
+    };
+
+    Result
+    replay(const Capture &cap, const Sampling &sm)
+    {
+        VSyncDetector v;
+        v.setSampling(sm.periodNs, sm.blockSize);
+        v.reset();
+        v.setEnableFPSCount(true);
+
+        auto toUs = [&](double sample)
+        { return sample * sm.periodNs / 1000; };
+
+        // DMA と同じく境界にそろえたバッファで渡す
+        std::vector<uint32_t> buf((sm.bufferSize + 3) / 4);
+        auto *p = reinterpret_cast<uint8_t *>(buf.data());
+
+        std::vector<double> detected; // us
+        uint64_t lastEdge = v.getLastEdgeTime();
+        double totalNs = 0;
+        double maxNs = 0;
+        int calls = 0;
+
+        size_t n = cap.samples.size();
+        for (size_t ofs = 0; ofs + sm.bufferSize <= n; ofs += sm.bufferSize)
+        {
+            memcpy(p, cap.samples.data() + ofs, sm.bufferSize);
+            uint64_t time = BASE_US + static_cast<uint64_t>(toUs(ofs + sm.bufferSize));
+
+            auto t0 = std::chrono::steady_clock::now();
+            v.update(p, sm.bufferSize, time);
+            auto t1 = std::chrono::steady_clock::now();
+            double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+            totalNs += ns;
+            maxNs = std::max(maxNs, ns);
+            ++calls;
+
+            v.updateTiming(time);
+            if (v.getLastEdgeTime() != lastEdge)
+            {
+                lastEdge = v.getLastEdgeTime();
+                detected.push_back(static_cast<double>(lastEdge - BASE_US));
+            }
+        }
+
+        Result r;
+        r.fps100 = v.getFPS100();
+        r.locked = v.isLocked();
+        r.detected = detected.size();
+        r.detMissed = v.getMissedEdges();
+        r.detExtra = v.getExtraEdges();
+        r.nsPerCall = calls ? totalNs / calls : 0;
+        r.maxNsPerCall = maxNs;
+
+        if (cap.edges.empty())
+        {
+            return r;
+        }
+
+        std::vector<double> truth;
+        double endUs = toUs(n / sm.bufferSize * sm.bufferSize);
+        for (auto e : cap.edges)
+        {
+            auto t = toUs(e);
+            if (t < endUs)
+            {
+                truth.push_back(t);
+            }
+        }
+        auto first = std::lower_bound(truth.begin(), truth.end(), WARMUP_US);
+        r.truthEdges = truth.end() - first;
+        if (r.truthEdges >= 2)
+        {
+            double period = (truth.back() - *first) / (r.truthEdges - 1);
+            r.truthFPS100 = static_cast<int>(std::lround(100e6 / period));
+        }
+
+        // 最寄りの正解から 1/4 フレーム以内なら一致とする
+        double tolerance = r.truthFPS100 ? 25e5 / r.truthFPS100 : 4000;
+        std::vector<bool> used(truth.size());
+        double sumError = 0;
+        for (auto d : detected)
+        {
+            auto it = std::lower_bound(truth.begin(), truth.end(), d);
+            int best = -1;
+            double bestError = tolerance;
+            for (auto c : {it - 1, it})
+            {
+                if (c >= truth.begin() && c < truth.end() &&
+                    std::abs(d - *c) <= bestError)
+                {
+                    best = c - truth.begin();
+                    bestError = std::abs(d - *c);
+                }
+            }
+            // 慣らしの間のものは数えない
+            if (best >= 0 ? truth[best] < WARMUP_US : d < WARMUP_US)
+            {
+                continue;
+            }
+            if (best < 0 || used[best])
+            {
+                ++r.falseEdges;
+                continue;
+            }
+            used[best] = true;
+            ++r.matched;
+            sumError += bestError;
+            r.maxError = std::max(r.maxError, bestError);
+        }
+        r.missedEdges = std::count(used.begin() + (first - truth.begin()), used.end(), false);
+        r.meanError = r.matched ? sumError / r.matched : 0;
+        return r;
+    }
+
+    void print(const Result &r, const Capture &cap, const Sampling &sm)
+    {
+        printf("  %zu samples, %d ns/sample, block %d, buffer %d\n",
+               cap.samples.size(), sm.periodNs, sm.blockSize, sm.bufferSize);
+        printf("  fps     : %d.%02d, %s\n",
+               r.fps100 / 100, r.fps100 % 100, r.locked ? "locked" : "unlocked");
+        if (!cap.edges.empty())
+        {
+            printf("  truth   : %d.%02d fps\n", r.truthFPS100 / 100, r.truthFPS100 % 100);
+            printf("  edges   : truth %d, detected %d, matched %d, false %d, missed %d\n",
+                   r.truthEdges, r.detected, r.matched, r.falseEdges, r.missedEdges);
+            printf("  phase   : mean %.1f us, max %.1f us\n", r.meanError, r.maxError);
+        }
+        // extra は予測より早すぎて捨てたエッジ
+        printf("  detector: missed %u, extra %u\n", r.detMissed, r.detExtra);
+        printf("  update(): %.0f ns/call avg, %.0f ns max\n", r.nsPerCall, r.maxNsPerCall);
+    }
+
+    ////
+
+    // 合成する複合同期信号
+    // アダプタ経由の ADC では同期パルスが高い側になる
+    struct SyncSignal
+    {
+        double lineUs = 63.556;
+        double lines = 262; // x.5 ならインターレース
+        int vsyncLines = 3;
+        double noise = 0;      // ガウスノイズの標準偏差
+        double spikeRate = 0;  // 1 サンプルあたりのスパイクの確率
+        double durationUs = 5000000;
+        std::vector<std::pair<double, double>> dropouts; // us
+    };
+
+    Capture
+    synthesize(const SyncSignal &s, const Sampling &sm)
+    {
+        constexpr int SYNC_LEVEL = 200;
+        constexpr int BLANK_LEVEL = 30;
+        constexpr double HSYNC_US = 4.7;
+
+        std::mt19937 rng(1);
+        std::normal_distribution<double> noise(0, s.noise ? s.noise : 1);
+        std::uniform_real_distribution<double> uni(0, 1);
+
+        Capture cap;
+        double field = s.lineUs * s.lines;
+        size_t n = static_cast<size_t>(s.durationUs * 1000 / sm.periodNs);
+        cap.samples.resize(n);
+        for (double t = 0; t < s.durationUs; t += field)
+        {
+            cap.edges.push_back(t * 1000 / sm.periodNs);
+        }
+
+        int spike = 0;
+        for (size_t i = 0; i < n; ++i)
+        {
+            double t = i * sm.periodNs / 1000.0;
+            double tf = std::fmod(t, field);
+            double tl = std::fmod(tf, s.lineUs);
+
+            bool sync;
+            if (tf < s.vsyncLines * s.lineUs)
+            {
+                // 切り込みパルス
+                sync = std::fmod(tf, s.lineUs / 2) < s.lineUs / 2 - HSYNC_US;
+            }
+            else
+            {
+                sync = tl < HSYNC_US;
+            }
+            double v = sync ? SYNC_LEVEL : BLANK_LEVEL;
+
+            for (auto &d : s.dropouts)
+            {
+                if (t >= d.first && t < d.second)
+                {
+                    v = BLANK_LEVEL;
+                }
+            }
+            if (s.noise)
+            {
+                v += noise(rng);
+            }
+            if (spike || (s.spikeRate && uni(rng) < s.spikeRate))
+            {
+                spike = spike ? spike - 1 : 4;
+                v = 255;
+            }
+            cap.samples[i] = static_cast<uint8_t>(std::clamp(v, 0.0, 255.0));
+        }
+        return cap;
+    }
+
+    struct Scenario
+    {
+        const char *name;
+        SyncSignal signal;
+        Sampling sampling;
+        double maxMeanError; // us
+    };
+
+    bool check(const Scenario &sc)
+    {
+        auto cap = synthesize(sc.signal, sc.sampling);
+        auto r = replay(cap, sc.sampling);
+        printf("%s:\n", sc.name);
+        print(r, cap, sc.sampling);
+
+        bool ok = true;
+        auto expect = [&](bool f, const char *what)
+        {
+            if (!f)
+            {
+                printf("  FAILED: %s\n", what);
+                ok = false;
+            }
+        };
+        expect(r.locked, "not locked");
+        expect(std::abs(r.fps100 - r.truthFPS100) <= 1, "fps");
+        expect(r.falseEdges == 0, "false edges");
+        // 途切れている間のエッジ以外は見逃さない
+        int maxMissed = 0;
+        for (auto e : cap.edges)
+        {
+            double t = e * sc.sampling.periodNs / 1000;
+            for (auto &d : sc.signal.dropouts)
+            {
+                maxMissed += t >= d.first && t < d.second;
+            }
+        }
+        expect(r.missedEdges <= maxMissed, "missed edges");
+        expect(r.meanError <= sc.maxMeanError, "phase error");
+        return ok;
+    }
+
+    int runSelfTest()
+    {
+        Sampling synchro;
+        Sampling fps{8000, 8, 1024};
+
+        SyncSignal progressive;
+
+        SyncSignal noisy;
+        noisy.noise = 20;
+        noisy.spikeRate = 0.0005;
+
+        SyncSignal interlaced;
+        interlaced.lines = 262.5;
+
+        SyncSignal dropout;
+        dropout.dropouts = {{1000000, 1050000}, {2500000, 2520000}, {3000000, 3300000}};
+
+        SyncSignal pal;
+        pal.lineUs = 64;
+        pal.lines = 312.5;
+        pal.noise = 10;
+
+        const Scenario scenarios[] = {
+            {"progressive", progressive, synchro, 20},
+            {"noise+spikes", noisy, synchro, 40},
+            {"interlace", interlaced, synchro, 20},
+            {"dropout", dropout, synchro, 20},
+            {"pal interlace", pal, synchro, 30},
+            {"progressive (fps sampling)", progressive, fps, 80},
+        };
+
+        int failed = 0;
+        for (auto &sc : scenarios)
+        {
+            failed += !check(sc);
+        }
+        printf(failed ? "%d scenario(s) FAILED\n" : "OK\n", failed);
+        return failed ? 1 : 0;
+    }
+
+    bool load(Capture &cap, const char *samplePath, const char *edgePath)
+    {
+        auto *fp = fopen(samplePath, "rb");
+        if (!fp)
+        {
+            fprintf(stderr, "cannot open %s\n", samplePath);
+            return false;
+        }
+        uint8_t buf[4096];
+        size_t n;
+        while ((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+        {
+            cap.samples.insert(cap.samples.end(), buf, buf + n);
+        }
+        fclose(fp);
+
+        if (edgePath)
+        {
+            fp = fopen(edgePath, "r");
+            if (!fp)
+            {
+                fprintf(stderr, "cannot open %s\n", edgePath);
+                return false;
+            }
+            double e;
+            while (fscanf(fp, "%lf", &e) == 1)
+            {
+                cap.edges.push_back(e);
+            }
+            fclose(fp);
+            std::sort(cap.edges.begin(), cap.edges.end());
+        }
+        return true;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        return runSelfTest();
+    }
+
+    Sampling sm;
+    const char *paths[2]{};
+    int nPaths = 0;
+    for (int i = 1; i < argc; ++i)
+    {
+        if (argv[i][0] == '-' && argv[i][1] && !argv[i][2] && i + 1 < argc)
+        {
+            int v = atoi(argv[++i]);
+            switch (argv[i - 1][1])
+            {
+            case 'p':
+                sm.periodNs = v;
+                continue;
+            case 'b':
+                sm.blockSize = v;
+                continue;
+            case 'n':
+                sm.bufferSize = v;
+                continue;
+            }
+        }
+        else if (argv[i][0] != '-' && nPaths < 2)
+        {
+            paths[nPaths++] = argv[i];
+            continue;
+        }
+        fprintf(stderr, "usage: %s capture.bin [edges.txt] [-p periodNs] [-b blockSize] [-n bufferSize]\n", argv[0]);
+        return 2;
+    }
+    if (sm.periodNs <= 0 || sm.blockSize <= 0 || sm.bufferSize < sm.blockSize)
+    {
+        fprintf(stderr, "bad sampling parameters\n");
+        return 2;
+    }
+
+    Capture cap;
+    if (!load(cap, paths[0], paths[1]))
+    {
+        return 1;
+    }
+    printf("%s:\n", paths[0]);
+    print(replay(cap, sm), cap, sm);
+    return 0;
+}
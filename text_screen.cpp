@@ -12,8 +12,7 @@ void TextScreen::fill(int x, int y, Layer layer, int n, char c)
 {
     int pt = x + y * WIDTH + static_cast<int>(layer) * LAYER_SIZE;
     n = std::min(n, BUFFER_SIZE - pt);
-    memset(&buf_[pt], c, n);
-    textChanged_ = true;
+    fillChanged(&buf_[pt], n, c);
 }
 
 void TextScreen::print(int x, int y, Layer layer, const char *s)
@@ -21,15 +20,28 @@ void TextScreen::print(int x, int y, Layer layer, const char *s)
     int pt = x + y * WIDTH + static_cast<int>(layer) * LAYER_SIZE;
     int n = strlen(s);
     n = std::min(n, WIDTH - x);
-    memcpy(&buf_[pt], s, n);
-    textChanged_ = true;
+    // 同じ内容なら flip しない
+    if (memcmp(&buf_[pt], s, n))
+    {
+        memcpy(&buf_[pt], s, n);
+        textChanged_ = true;
+    }
 }
 
 void TextScreen::clearLayer(Layer layer)
 {
     auto ofs = static_cast<int>(layer) * LAYER_SIZE;
-    memset(&buf_[ofs], layer == Layer::BASE ? ' ' : 0, LAYER_SIZE);
-    textChanged_ = true;
+    fillChanged(&buf_[ofs], LAYER_SIZE, layer == Layer::BASE ? ' ' : 0);
+}
+
+void TextScreen::fillChanged(char *p, int n, char c)
+{
+    if (std::find_if(p, p + n, [c](char v)
+                     { return v != c; }) != p + n)
+    {
+        memset(p, c, n);
+        textChanged_ = true;
+    }
 }
 
 void TextScreen::clearAll()
@@ -46,6 +46,7 @@ public:
     bool isInfoActive() const { return infoLayerClearTimer_ > 0; }
 
 protected:
+    void fillChanged(char *p, int n, char c);
     bool sendText();
     bool sendFont();
 
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+#
+# author : Shuichi TAKANO
+# since  : Sun Oct 18 2026 17:48:02
+#
+# UART に出したトレース (trace::dump) を Chrome/Perfetto の trace JSON にする
+#   python3 tools/trace_to_chrome.py uart.log > trace.json
+# chrome://tracing か https://ui.perfetto.dev で開く
+
+import argparse
+import json
+import struct
+import sys
+
+# trace.h の Record
+RECORD = struct.Struct("<QIHBB")
+
+# trace.h の Event と合わせる
+# type: (名前, 表示する行, 種類)
+#   i: 瞬間, B/E: 区間の始まりと終わり, C: 値の変化
+EVENTS = {
+    1: ("hid", "usb", "i"),
+    2: ("xinput", "usb", "i"),
+    3: ("vsync", "vsync", "i"),
+    4: ("rapid flip", "vsync", "i"),
+    5: ("pins", "pins", "C"),
+    6: ("i2c send", "i2c", "i"),
+    7: ("i2c", "i2c", "B"),
+    8: ("i2c", "i2c", "E"),
+    9: ("erase", "flash", "B"),
+    10: ("erase", "flash", "E"),
+    11: ("program", "flash", "B"),
+    12: ("program", "flash", "E"),
+    13: ("save", "save", "B"),
+    14: ("save", "save", "E"),
+}
+
+TRACKS = ["usb", "vsync", "pins", "i2c", "flash", "save"]
+
+
+def read_records(lines):
+    """最後の TRACE BEGIN から TRACE END までを読む"""
+    result = None
+    records = None
+    total = 0
+    for line in lines:
+        line = line.strip()
+        if line.startswith("TRACE BEGIN"):
+            records = []
+            total = int(line.split()[3])
+        elif line == "TRACE END":
+            if records is not None:
+                result = (records, total)
+            records = None
+        elif records is not None:
+            try:
+                records.append(RECORD.unpack(bytes.fromhex(line)))
+            except ValueError:
+                # 他の出力が混ざった行は捨てる
+                pass
+    if result is None:
+        sys.exit("no complete TRACE BEGIN/END block found")
+    return result
+
+
+def args_of(type_, port, arg, data):
+    if type_ in (1, 2):
+        return {"port": port, "len": arg, "dev": data >> 8, "instance": data & 0xff}
+    if type_ == 3:
+        return {"tracked": arg, "period_us": data / 256}
+    if type_ == 4:
+        return {"locked": arg, "counter": data}
+    if type_ == 6:
+        return {"addr": "0x%02x" % port, "len": arg}
+    if type_ == 7:
+        return {"addr": "0x%02x" % port, "len": arg, "read": data}
+    if type_ in (9, 11):
+        return {"ofs": "0x%x" % data}
+    if type_ == 14:
+        return {"result": ("done", "aborted", "verify failed")[arg] if arg < 3 else arg}
+    return {}
+
+
+def convert(records):
+    events = []
+    for i, name in enumerate(TRACKS):
+        events.append({"ph": "M", "pid": 0, "tid": i, "name": "thread_name",
+                       "args": {"name": name}})
+
+    # リングは古い順だが, vsync は推定したエッジの時刻なので前後する
+    records = sorted(records, key=lambda r: r[0])
+    t0 = records[0][0] if records else 0
+    # 上書きされて始まりが無い区間の終わりは捨てる
+    opened = {}
+    for time, data, arg, type_, port in records:
+        if type_ not in EVENTS:
+            continue
+        name, track, ph = EVENTS[type_]
+        if ph == "B":
+            opened[name] = opened.get(name, 0) + 1
+        elif ph == "E":
+            if not opened.get(name):
+                continue
+            opened[name] -= 1
+        ev = {"name": name, "ph": ph, "ts": time - t0, "pid": 0,
+              "tid": TRACKS.index(track)}
+        if ph == "i":
+            ev["s"] = "t"
+            ev["args"] = args_of(type_, port, arg, data)
+        elif ph == "B":
+            ev["args"] = args_of(type_, port, arg, data)
+        elif ph == "C":
+            ev["name"] = "pins %dP" % (port + 1)
+            ev["args"] = {"buttons": data}
+        events.append(ev)
+    return {"traceEvents": events, "displayTimeUnit": "ms"}
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("input", nargs="?", type=argparse.FileType("r"),
+                        default=sys.stdin, help="UART log (default: stdin)")
+    parser.add_argument("-o", "--output", type=argparse.FileType("w"),
+                        default=sys.stdout, help="trace JSON (default: stdout)")
+    args = parser.parse_args()
+
+    records, total = read_records(args.input)
+    if total > len(records):
+        print("%d events, %d older ones were overwritten" % (len(records), total - len(records)),
+              file=sys.stderr)
+    json.dump(convert(records), args.output)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,101 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 17:20:45
+ */
+
+#include "trace.h"
+
+#ifdef ENABLE_TRACE
+
+#include <pico/stdlib.h>
+#include <hardware/sync.h>
+#include <hardware/watchdog.h>
+#include <stdio.h>
+#include "debug.h"
+
+namespace trace
+{
+    namespace
+    {
+        Record records_[N_RECORDS];
+        uint32_t count_ = 0; // 今までに記録した数. 位置は count_ % N_RECORDS
+        bool enabled_ = true;
+
+        static_assert((N_RECORDS & (N_RECORDS - 1)) == 0);
+    }
+
+    void record(uint64_t time, Event type, int port, int arg, uint32_t data)
+    {
+        auto irq = save_and_disable_interrupts();
+        if (enabled_)
+        {
+            records_[count_ & (N_RECORDS - 1)] = {time, data, static_cast<uint16_t>(arg),
+                                                  type, static_cast<uint8_t>(port)};
+            ++count_;
+        }
+        restore_interrupts(irq);
+    }
+
+    void record(Event type, int port, int arg, uint32_t data)
+    {
+        record(time_us_64(), type, port, arg, data);
+    }
+
+    void dump()
+    {
+        // logger の DMA 送信と混ざらないように先に送り切る
+        LOG_FLUSH();
+
+        enabled_ = false;
+
+        uint32_t n = count_ < N_RECORDS ? count_ : N_RECORDS;
+        printf("TRACE BEGIN %u %u\n", (unsigned)n, (unsigned)count_);
+        for (uint32_t i = count_ - n; i != count_; ++i)
+        {
+            // 115200bps だと全部で数秒かかる
+            if ((i & 63) == 0)
+            {
+                watchdog_update();
+            }
+
+            // Record をそのまま 16 進で
+            auto *p = reinterpret_cast<const uint8_t *>(&records_[i & (N_RECORDS - 1)]);
+            char buf[sizeof(Record) * 2 + 1];
+            for (size_t j = 0; j < sizeof(Record); ++j)
+            {
+                static constexpr char hex[] = "0123456789abcdef";
+                buf[j * 2] = hex[p[j] >> 4];
+                buf[j * 2 + 1] = hex[p[j] & 15];
+            }
+            buf[sizeof(buf) - 1] = 0;
+            puts(buf);
+        }
+        printf("TRACE END\n");
+
+        enabled_ = true;
+    }
+
+    void clear()
+    {
+        auto irq = save_and_disable_interrupts();
+        count_ = 0;
+        restore_interrupts(irq);
+    }
+
+    void handleRequest(int c)
+    {
+        switch (c)
+        {
+        case 't':
+            dump();
+            break;
+
+        case 'c':
+            clear();
+            LOG(("trace cleared\n"));
+            break;
+        }
+    }
+}
+
+#endif
@@ -0,0 +1,69 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sun Oct 18 2026 17:20:45
+ */
+#pragma once
+
+// 何がいつ起きたかを RAM のリングバッファに記録する
+// UART から 't' で吐き出して tools/trace_to_chrome.py で Chrome/Perfetto の形式にする
+// ENABLE_TRACE が無ければマクロは空になる
+
+#include <stdint.h>
+
+namespace trace
+{
+    // 値を変えると trace_to_chrome.py と合わなくなるので追加は末尾に
+    enum class Event : uint8_t
+    {
+        HID_REPORT = 1,  // port, arg: バイト数, data: dev_addr << 8 | instance
+        XINPUT_REPORT,   // port, arg: バイト数, data: dev_addr << 8 | instance
+        VSYNC_EDGE,      // arg: 予測に合ったか, data: 周期 (1/256 us)
+        RAPID_FLIP,      // arg: ロック中か, data: カウンタ
+        PIN_OUT,         // port, data: ボタンの状態
+        I2C_SEND,        // port: アドレス, arg: バイト数
+        I2C_BEGIN,       // port: アドレス, arg: バイト数, data: 0 書き込み / 1 読み込み
+        I2C_END,         // port: アドレス
+        FLASH_ERASE_BEGIN, // data: オフセット
+        FLASH_ERASE_END,
+        FLASH_PROGRAM_BEGIN, // data: オフセット
+        FLASH_PROGRAM_END,
+        SAVE_BEGIN,
+        SAVE_END, // arg: 0 完了, 1 内容が変わったのでやめた, 2 読み返しが合わない
+    };
+
+    // 1イベント 16byte
+    struct Record
+    {
+        uint64_t time; // us
+        uint32_t data;
+        uint16_t arg;
+        Event type;
+        uint8_t port;
+    };
+    static_assert(sizeof(Record) == 16);
+
+    inline constexpr int N_RECORDS = 1024;
+
+    void record(Event type, int port = 0, int arg = 0, uint32_t data = 0);
+    void record(uint64_t time, Event type, int port = 0, int arg = 0, uint32_t data = 0);
+
+    // UART に古い順に出す. 出している間は記録を止める
+    void dump();
+    void clear();
+    // UART からの要求. 't' で dump, 'c' で clear
+    void handleRequest(int c);
+}
+
+#ifdef ENABLE_TRACE
+#define TRACE(type, ...) trace::record(trace::Event::type, ##__VA_ARGS__)
+#define TRACE_AT(time, type, ...) trace::record(time, trace::Event::type, ##__VA_ARGS__)
+#else
+#define TRACE(type, ...) \
+    do                   \
+    {                    \
+    } while (0)
+#define TRACE_AT(time, type, ...) \
+    do                            \
+    {                             \
+    } while (0)
+#endif
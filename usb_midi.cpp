@@ -10,7 +10,7 @@
 #include "pad_manager.h"
 #include "debug.h"
 #include "util.h"
-#include <vector>
+#include "mem_stat.h"
 
 namespace
 {
@@ -23,7 +23,18 @@ namespace
             int note;
             uint32_t time; // keyon になった時の時間
         };
-        std::vector<Note> notes_;
+        // keyon した順. 古いものから keyoff する
+        static constexpr int N_NOTES = 32;
+        Note notes_[N_NOTES];
+        int noteTop_ = 0;
+        int nNotes_ = 0;
+
+        void popNote()
+        {
+            keyoff(notes_[noteTop_].note);
+            noteTop_ = (noteTop_ + 1) % N_NOTES;
+            --nNotes_;
+        }
 
         void clear()
         {
@@ -36,8 +47,13 @@ namespace
         void keyon(int note)
         {
             assert(note < 128);
+            if (nNotes_ == N_NOTES)
+            {
+                // 溢れたら一番古いものを早めに離す
+                popNote();
+            }
             keys_[note >> 5] |= 1u << (note & 31);
-            notes_.push_back({note, util::getSysTickCounter24()});
+            notes_[(noteTop_ + nNotes_++) % N_NOTES] = {note, util::getSysTickCounter24()};
         }
 
         void keyoff(int note)
@@ -63,17 +79,16 @@ namespace
         void update()
         {
             auto now = util::getSysTickCounter24();
-            if (!notes_.empty())
+            if (nNotes_)
             {
                 // 1つ確認すれば十分
-                auto diff = (notes_.front().time - now) & 0xffffff;
+                auto diff = (notes_[noteTop_].time - now) & 0xffffff;
                 constexpr uint32_t CLOCK = 125000000;
                 //                constexpr auto threshold = CLOCK / 1000 * 100;
                 constexpr auto threshold = CLOCK / 1000 * 34;
                 if (diff > threshold)
                 {
-                    keyoff(notes_.front().note);
-                    notes_.erase(notes_.begin());
+                    popNote();
                     send();
                 }
             }
@@ -81,10 +96,16 @@ namespace
     };
 
     MIDIState midiState_;
+
+    // MIDI として繋がっている devaddr のビット
+    // umount は MIDI 以外からも来るので, preloadConfig() したものだけ releaseConfig() する
+    uint32_t midiDevices_ = 0;
+    static_assert(CFG_TUH_DEVICE_MAX < 32);
 }
 
 void updateMIDIState()
 {
+    MEMSTAT_SCOPE(INPUT);
     midiState_.update();
 }
 
@@ -96,16 +117,24 @@ extern "C"
                 dev_addr, in_ep & 0xf, num_cables_rx, out_ep & 0xf, num_cables_tx));
 
         midiState_.clear();
+        PadManager::instance().preloadConfig(PadManager::VID_MIDI, PadManager::PID_MIDI);
+        midiDevices_ |= 1u << dev_addr;
     }
 
     void tuh_midi_umount_cb(uint8_t dev_addr, uint8_t instance)
     {
         // MIDI じゃないやつからも来ちゃう
         DPRINT(("MIDI device address = %d, instance = %d is unmounted\r\n", dev_addr, instance));
+        if (midiDevices_ & (1u << dev_addr))
+        {
+            midiDevices_ &= ~(1u << dev_addr);
+            PadManager::instance().releaseConfig(PadManager::VID_MIDI, PadManager::PID_MIDI);
+        }
     }
 
     void tuh_midi_rx_cb(uint8_t dev_addr, uint32_t num_packets)
     {
+        MEMSTAT_SCOPE(INPUT);
         while (num_packets--)
         {
             uint8_t packet[4]{};
@@ -5,7 +5,13 @@
 
 #pragma once
 #include <stdio.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <pico.h>
 #include <hardware/structs/systick.h>
+#ifdef ENABLE_ASYNC_LOG
+#include "logger.h"
+#endif
 
 namespace util
 {
@@ -13,6 +19,12 @@ namespace util
     dumpBytes(const void *p, size_t size)
     {
         auto *pp = static_cast<const uint8_t *>(p);
+#ifdef ENABLE_ASYNC_LOG
+        for (size_t i = 0; i < size; i += 16)
+        {
+            logger::pushBytes(pp + i, size - i < 16 ? size - i : 16);
+        }
+#else
         size_t i = 0;
         while (i < size)
         {
@@ -27,6 +39,7 @@ namespace util
         {
             printf("\n");
         }
+#endif
     }
 
     inline void initSysTick()
@@ -37,8 +50,54 @@ namespace util
 
     // tick counterを取得
     // カウンタは減っていくのに注意
-    inline uint32_t getSysTickCounter24()
+    // flash 操作中も動く IRQ から呼ぶので, 最適化なしでも flash 上に実体を作らない
+    __force_inline uint32_t getSysTickCounter24()
     {
         return systick_hw->cvr;
     }
+
+    // サイクル数の統計
+    // ISR からも呼ばれるので除算はしない
+    struct CycleStats
+    {
+        uint32_t min = ~0u;
+        uint32_t max = 0;
+        uint32_t ave16 = 0; // 平均の16倍 (1/16 の IIR)
+        uint32_t count = 0;
+
+        // getSysTickCounter24() と同じく flash 上に実体を作らない
+        __force_inline void add(uint32_t c)
+        {
+            min = c < min ? c : min;
+            max = c > max ? c : max;
+            ave16 = count ? ave16 + c - (ave16 >> 4) : c << 4;
+            ++count;
+        }
+
+        uint32_t getMin() const { return count ? min : 0; }
+        uint32_t getMax() const { return max; }
+        uint32_t getAve() const { return ave16 >> 4; }
+
+        void reset() { *this = {}; }
+    };
+
+    // CRC-32 (IEEE). 4bit ずつ処理する
+    inline uint32_t crc32(uint32_t crc, const void *p, size_t size)
+    {
+        static constexpr uint32_t table[16] = {
+            0x00000000, 0x1db71064, 0x3b6e20c8, 0x26d930ac,
+            0x76dc4190, 0x6b6b51f4, 0x4db26158, 0x5005713c,
+            0xedb88320, 0xf00f9344, 0xd6d6a3e8, 0xcb61b38c,
+            0x9b64c2b0, 0x86d3d2d4, 0xa00ae278, 0xbdbdf21c};
+
+        auto *pp = static_cast<const uint8_t *>(p);
+        crc = ~crc;
+        while (size--)
+        {
+            crc ^= *pp++;
+            crc = (crc >> 4) ^ table[crc & 15];
+            crc = (crc >> 4) ^ table[crc & 15];
+        }
+        return ~crc;
+    }
 }
\ No newline at end of file
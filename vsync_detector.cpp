@@ -0,0 +1,355 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sat Oct 17 2026 15:24:08
+ */
+
+#include "vsync_detector.h"
+#include "trace.h"
+#include <pico.h>
+#include <algorithm>
+#include <atomic>
+#include <stdlib.h>
+
+namespace
+{
+    // 4byte をまとめて読むための型
+    typedef uint32_t __attribute__((__may_alias__)) Word;
+}
+
+void VSyncDetector::reset()
+{
+    min_ = 256;
+    max_ = 0;
+    prevLv_ = false;
+    prevAcc_ = 0;
+    interval_ = 0;
+    curInterval_ = 0;
+
+    prevEdgeCount_ = edgeCount_;
+    hasLastEdge_ = false;
+    resetTracker();
+}
+
+// n(<=512) バイトの総和
+// 4byte 境界にそろった部分は 16bit x 2 レーンで 4byte ずつ加算する
+int __not_in_flash_func(VSyncDetector::sumBytes)(const uint8_t *p, int n)
+{
+    int acc = 0;
+    for (; n && (reinterpret_cast<uintptr_t>(p) & 3); --n)
+    {
+        acc += *p++;
+    }
+
+    auto *pw = reinterpret_cast<const Word *>(p);
+    uint32_t accW = 0;
+    for (int ct = n >> 2; ct; --ct)
+    {
+        uint32_t w = *pw++;
+        accW += w & 0x00ff00ff;
+        accW += (w >> 8) & 0x00ff00ff;
+    }
+    acc += (accW & 0xffff) + (accW >> 16);
+
+    p = reinterpret_cast<const uint8_t *>(pw);
+    for (n &= 3; n; --n)
+    {
+        acc += *p++;
+    }
+    return acc;
+}
+
+// DMA IRQ から呼ばれるので RAM に置く
+void __not_in_flash_func(VSyncDetector::update)(const uint8_t *p, int n, uint64_t time)
+{
+    int th = (max_ + min_) >> 1;
+
+    max_ -= th >> 8;
+    min_ += th >> 8;
+
+    bool pl = prevLv_;
+    int pacc = prevAcc_;
+    int detRest = -1;
+    int detPrev = 0;
+    int detCur = 0;
+
+    const int blockSize = blockSize_;
+    while (n >= blockSize)
+    {
+        int acc = sumBytes(p, blockSize);
+        p += blockSize;
+        n -= blockSize;
+
+        // std::max/min は flash 上に実体ができることがあるので使わない
+        max_ = acc > max_ ? acc : max_;
+        min_ = acc < min_ ? acc : min_;
+
+        bool lv = acc > th;
+
+        if ((pl ^ lv) & lv)
+        {
+            detRest = n;
+            detPrev = pacc;
+            detCur = acc;
+        }
+        pl = lv;
+        pacc = acc;
+    }
+
+    ++curInterval_;
+
+    if (detRest >= 0)
+    {
+        interval_ = curInterval_;
+        curInterval_ = 0;
+
+        // 時刻の計算は main loop 側 (updateTiming) で行う
+        edge_ = {time, detRest, detPrev, detCur, min_, max_};
+        std::atomic_signal_fence(std::memory_order_release);
+        edgeCount_ = edgeCount_ + 1;
+    }
+
+    prevLv_ = pl;
+    prevAcc_ = pacc;
+}
+
+void VSyncDetector::updateTiming(uint64_t now)
+{
+    EdgeInfo e;
+    uint32_t ct;
+    do
+    {
+        ct = edgeCount_;
+        std::atomic_signal_fence(std::memory_order_acquire);
+        e = edge_;
+        std::atomic_signal_fence(std::memory_order_acquire);
+    } while (ct != edgeCount_);
+
+    uint64_t nowQ8 = now << 8;
+
+    if (auto nEdges = ct - prevEdgeCount_)
+    {
+        prevEdgeCount_ = ct;
+
+        auto t = getEdgeTime(e);
+        bool tracked = trackEdge(t, nEdges - 1);
+        TRACE_AT(t, VSYNC_EDGE, 0, tracked, periodQ8_);
+        if (tracked)
+        {
+            scheduleFlip(t);
+        }
+        updateFPS();
+    }
+    else if (periodQ8_ &&
+             nowQ8 > nextEdgeQ8_ + uint64_t(periodQ8_) * LOST_FRAMES)
+    {
+        // 信号が途絶えた
+        hasLastEdge_ = false;
+        resetTracker();
+    }
+
+    if (flipPending_ && static_cast<int64_t>(nowQ8 - flipTimeQ8_) >= 0)
+    {
+        ++counter_;
+        lastFlipQ8_ = flipTimeQ8_;
+        TRACE_AT(flipTimeQ8_ >> 8, RAPID_FLIP, 0, isLocked(), counter_);
+        if (isLocked())
+        {
+            // ロック中はエッジを待たずに予測で進める
+            flipTimeQ8_ += periodQ8_;
+        }
+        else
+        {
+            flipPending_ = false;
+        }
+    }
+}
+
+std::array<char, 6> VSyncDetector::getFPSString() const
+{
+    int fps100 = getFPS100();
+    std::array<char, 6> buf;
+    buf[5] = 0;
+    if (fps100 == 0)
+    {
+        buf = {'-', '-', '.', '-', '-', 0};
+        return buf;
+    }
+
+    buf[4] = '0' + fps100 % 10;
+    buf[3] = '0' + fps100 / 10 % 10;
+    buf[2] = '.';
+    buf[1] = '0' + fps100 / 100 % 10;
+    buf[0] = '0' + fps100 / 1000 % 10;
+    return buf;
+}
+
+// エッジ位置をブロック内まで補間して絶対時刻 (us) にする
+uint64_t VSyncDetector::getEdgeTime(const EdgeInfo &e) const
+{
+    // 直前ブロックとエッジを含むブロックの lo からの超過分が
+    // エッジ以降の hi の長さに比例するとみなす
+    int d = blockSize_;
+    int range = e.hi - e.lo;
+    if (range > 0)
+    {
+        d = std::clamp((e.accPrev + e.accCur - 2 * e.lo) * blockSize_ / range,
+                       0, blockSize_ * 2);
+    }
+    int64_t ns = static_cast<int64_t>(e.samplesAfter + d) * samplePeriodNs_;
+    return e.bufferTime - static_cast<uint64_t>((ns + 500) / 1000);
+}
+
+void VSyncDetector::resetTracker()
+{
+    periodQ8_ = 0;
+    lockCount_ = 0;
+    unlockCount_ = 0;
+    locked_ = false;
+    rejectCount_ = 0;
+    flipPending_ = false;
+    curFPS100_ = 0;
+}
+
+// エッジ時刻 t で推定を更新する
+// skipped は main loop が見逃したエッジ数 (欠落としては数えない)
+// 余分なエッジとして捨てた場合は false
+bool VSyncDetector::trackEdge(uint64_t t, int skipped)
+{
+    uint64_t tq = t << 8;
+    uint64_t prevEdge = lastEdgeTime_;
+    bool hadEdge = hasLastEdge_;
+    lastEdgeTime_ = t;
+    hasLastEdge_ = true;
+
+    if (!periodQ8_)
+    {
+        // 捕捉: 連続した2エッジの間隔を初期値にする
+        if (hadEdge && !skipped)
+        {
+            uint32_t d = t - prevEdge;
+            if (d >= MIN_PERIOD && d <= MAX_PERIOD)
+            {
+                periodQ8_ = d << 8;
+                nextEdgeQ8_ = tq + periodQ8_;
+            }
+        }
+        return true;
+    }
+
+    int64_t err = static_cast<int64_t>(tq - nextEdgeQ8_);
+    int64_t period = periodQ8_;
+
+    if (err < -(period >> 2))
+    {
+        // 予測よりずっと早い: ノイズによる余分なエッジとみなす
+        ++extraEdges_;
+        countLockError(true);
+        if (++rejectCount_ > MAX_REJECT)
+        {
+            // 周波数が変わったのかもしれないので捕捉しなおす
+            resetTracker();
+            return true;
+        }
+        lastEdgeTime_ = prevEdge;
+        return false;
+    }
+    rejectCount_ = 0;
+
+    // 予測時刻を過ぎて来た分は欠落したエッジ
+    int missed = 0;
+    if (err > (period >> 1))
+    {
+        missed = (err + (period >> 1)) / period;
+        nextEdgeQ8_ += period * missed;
+        err -= period * missed;
+        missedEdges_ += std::max(0, missed - skipped);
+    }
+
+    if (std::abs(err) > (period >> 3))
+    {
+        // 大きくずれたら直前の間隔から合わせなおす
+        uint32_t d = t - prevEdge;
+        if (!missed && !skipped && d >= MIN_PERIOD && d <= MAX_PERIOD)
+        {
+            periodQ8_ = d << 8;
+        }
+        nextEdgeQ8_ = tq;
+        countLockError(true);
+    }
+    else
+    {
+        nextEdgeQ8_ += err >> PHASE_GAIN_SHIFT;
+        periodQ8_ = std::clamp<int64_t>(period + (err >> PERIOD_GAIN_SHIFT) / (missed + 1),
+                                        MIN_PERIOD << 8, MAX_PERIOD << 8);
+        countLockError(std::abs(err) >= (LOCK_ERROR << 8));
+    }
+    nextEdgeQ8_ += periodQ8_;
+    return true;
+}
+
+// ロック状態の更新
+// 一度ロックしたら UNLOCK_COUNT 回続けて外れるまではロック中とする
+void VSyncDetector::countLockError(bool error)
+{
+    if (error)
+    {
+        lockCount_ = 0;
+        if (++unlockCount_ >= UNLOCK_COUNT)
+        {
+            locked_ = false;
+        }
+    }
+    else
+    {
+        unlockCount_ = 0;
+        if (++lockCount_ >= LOCK_COUNT)
+        {
+            lockCount_ = LOCK_COUNT;
+            locked_ = true;
+        }
+    }
+}
+
+// このフレームの synchro 切り替え時刻を決める
+void VSyncDetector::scheduleFlip(uint64_t t)
+{
+    uint64_t period = periodQ8_;
+    uint64_t phase = period * fetchPhase_ / 10;
+
+    // ロック中は実測よりも予測のフレーム境界を使う
+    uint64_t edge = isLocked() ? nextEdgeQ8_ - period : t << 8;
+    uint64_t f = edge + phase;
+
+    if (static_cast<int64_t>(f - (lastFlipQ8_ + (period >> 1))) < 0)
+    {
+        // このフレームの分は予測で既に出している
+        f += period;
+    }
+    if (flipPending_ &&
+        static_cast<int64_t>(f - (flipTimeQ8_ + (period >> 1))) > 0)
+    {
+        // 前フレームの分が残っていたら先に出す
+        ++counter_;
+        lastFlipQ8_ = flipTimeQ8_;
+        TRACE_AT(flipTimeQ8_ >> 8, RAPID_FLIP, 0, isLocked(), counter_);
+    }
+    flipTimeQ8_ = f;
+    flipPending_ = true;
+}
+
+void VSyncDetector::updateFPS()
+{
+    if (!enableFPS_ || !isLocked())
+    {
+        curFPS100_ = 0;
+        return;
+    }
+
+    // 1/10000 Hz 単位で求め, 表示桁 (1/100 Hz) の境界でばたつかないようにする
+    uint32_t fps10000 = uint64_t(256) * 10000'000000 / periodQ8_;
+    if (curFPS100_ == 0 ||
+        std::abs(static_cast<int>(fps10000 - curFPS100_ * 100)) > 60)
+    {
+        curFPS100_ = (fps10000 + 50) / 100;
+    }
+}
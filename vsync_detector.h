@@ -0,0 +1,140 @@
+/*
+ * author : Shuichi TAKANO
+ * since  : Sat Oct 17 2026 15:20:41
+ */
+#pragma once
+
+#include <stdint.h>
+#include <array>
+#include <pico.h>
+
+// 同期信号の ADC サンプルから VSync を検出する
+// ハードウェアには触らないので、キャプチャしたサンプルを流し込めばホストでも動く
+class VSyncDetector
+{
+    // エッジ1つ分の情報. ISR -> main loop
+    struct EdgeInfo
+    {
+        uint64_t bufferTime; // バッファ完了時刻 (us)
+        int samplesAfter;    // エッジを含むブロック終端からバッファ終端までのサンプル数
+        int accPrev;         // エッジ直前のブロックの積算値
+        int accCur;          // エッジを含むブロックの積算値
+        int lo;              // その時点の min_
+        int hi;              // その時点の max_
+    };
+
+    // ISR 側
+    int min_ = 256;
+    int max_ = 0;
+
+    bool prevLv_ = false;
+    int prevAcc_ = 0;
+
+    int interval_ = 0;
+    int curInterval_ = 0;
+
+    // edge_ を書いてから edgeCount_ を進める
+    EdgeInfo edge_{};
+    volatile uint32_t edgeCount_ = 0;
+
+    // 積算ブロックのサンプル数. ADC 停止中に設定する
+    int blockSize_ = 32;
+    int blockShift_ = 5;
+
+    // 以下 main loop 側
+    int samplePeriodNs_ = 2000;
+    int fetchPhase_ = 5; // 1/10 フレーム単位
+    uint32_t counter_ = 0;
+
+    uint32_t prevEdgeCount_ = 0;
+    uint64_t lastEdgeTime_ = 0;
+    bool hasLastEdge_ = false;
+
+    // 周期推定 (PLL)
+    // 時刻と周期は 1/256 us 単位
+    uint64_t nextEdgeQ8_ = 0; // 次の vsync の予測時刻
+    uint32_t periodQ8_ = 0;   // 0 なら未捕捉
+    int lockCount_ = 0;   // 連続して予測に合ったエッジ数
+    int unlockCount_ = 0; // 連続して外れたエッジ数
+    bool locked_ = false;
+    int rejectCount_ = 0;
+    uint32_t missedEdges_ = 0;
+    uint32_t extraEdges_ = 0;
+
+    uint64_t flipTimeQ8_ = 0;
+    uint64_t lastFlipQ8_ = 0;
+    bool flipPending_ = false;
+
+    bool enableFPS_ = false;
+    uint32_t curFPS100_ = 0;
+
+    static constexpr uint32_t MIN_PERIOD = 8000;  // us (125Hz)
+    static constexpr uint32_t MAX_PERIOD = 50000; // us (20Hz)
+    static constexpr int PHASE_GAIN_SHIFT = 2;    // 位相の追従 1/4
+    static constexpr int PERIOD_GAIN_SHIFT = 5;   // 周期の追従 1/32
+    static constexpr int LOCK_ERROR = 64;         // us
+    static constexpr int LOCK_COUNT = 8;
+    static constexpr int UNLOCK_COUNT = 4;
+    static constexpr int MAX_REJECT = 4;
+    static constexpr int LOST_FRAMES = 8;
+
+public:
+    void reset();
+
+    // DMA IRQ から呼ばれる
+    // time はバッファ完了時刻 (us)
+    void update(const uint8_t *p, int n, uint64_t time);
+
+    // main loop から呼ぶ
+    void updateTiming(uint64_t now);
+
+    void setEnableFPSCount(bool f) { enableFPS_ = f; }
+    void setSampling(int periodNs, int blockSize)
+    {
+        samplePeriodNs_ = periodNs;
+        blockSize_ = blockSize;
+        blockShift_ = 0;
+        while ((2 << blockShift_) <= blockSize)
+        {
+            ++blockShift_;
+        }
+    }
+    void setFetchPhase(int phase) { fetchPhase_ = phase; }
+
+    uint32_t getCounter() const { return counter_; }
+    uint32_t getVSyncCounter() const { return counter_; }
+    int getFPS100() const { return curFPS100_; }
+    std::array<char, 6> getFPSString() const;
+
+    int getInterval() const { return interval_; }
+    uint32_t getEdgeCount() const { return edgeCount_; }
+    uint64_t getLastEdgeTime() const { return lastEdgeTime_; }
+
+    // 同期信号に追従しているか
+    // 信号が途絶えても LOST_FRAMES の間は予測で動き続ける
+    bool isLocked() const { return locked_; }
+    uint32_t getFramePeriod() const { return periodQ8_ >> 8; }
+    uint32_t getFramePeriodQ8() const { return periodQ8_; }
+    uint64_t getPredictedEdgeTime() const { return nextEdgeQ8_ >> 8; }
+    uint32_t getMissedEdges() const { return missedEdges_; }
+    uint32_t getExtraEdges() const { return extraEdges_; }
+
+    int getMin() const { return min_; }
+    int getMax() const { return max_; }
+
+    // 1サンプルあたりのしきい値. ISR から呼んでも良い
+    // DMA IRQ から呼ぶので flash 上に実体を作らない
+    __force_inline int getSampleThreshold() const { return ((min_ + max_) >> 1) >> blockShift_; }
+
+    // n(<=512) バイトの総和
+    static int sumBytes(const uint8_t *p, int n);
+
+protected:
+    uint64_t getEdgeTime(const EdgeInfo &e) const;
+
+    void resetTracker();
+    void countLockError(bool error);
+    bool trackEdge(uint64_t t, int skipped);
+    void scheduleFlip(uint64_t t);
+    void updateFPS();
+};